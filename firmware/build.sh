@@ -8,12 +8,21 @@ echo "Building TinyKB firmware..."
 # Build configuration
 MCU=attiny85
 F_CPU=16500000UL
-BUILD_DIR=build
+BUILD_DIR=${BUILD_DIR:-build}
 SRC_DIR=src
 USB_LIB_DIR=lib/usbdrv
 
+# Optional features (see src/config.h), e.g. FEATURES="-DFEATURE_STRING_PACKED=1"
+FEATURES=${FEATURES:-}
+
+# Flash left by the Micronucleus bootloader (raise for ISP-flashed boards)
+MAX_FLASH=${MAX_FLASH:-6012}
+
+# Stack space to keep free below static RAM (USB interrupt + deepest call chain)
+MIN_STACK=${MIN_STACK:-96}
+
 # Compiler flags and settings
-CFLAGS="-mmcu=${MCU} -DF_CPU=${F_CPU} -Os -Wall -Wextra -std=c99 -ffunction-sections -fdata-sections"
+CFLAGS="-mmcu=${MCU} -DF_CPU=${F_CPU} -Os -Wall -Wextra -std=c99 -ffunction-sections -fdata-sections ${FEATURES}"
 INCLUDES="-I${SRC_DIR} -I${USB_LIB_DIR}"
 LDFLAGS="-mmcu=${MCU} -Wl,--gc-sections"
 
@@ -44,7 +53,9 @@ avr-gcc $CFLAGS $INCLUDES -c ${SRC_DIR}/usb_rawhid.c -o ${BUILD_DIR}/usb_rawhid.
 
 # Phase 5: Keyboard mode
 avr-gcc $CFLAGS $INCLUDES -c ${SRC_DIR}/usb_keyboard.c -o ${BUILD_DIR}/usb_keyboard.o
+avr-gcc $CFLAGS $INCLUDES -c ${SRC_DIR}/usb_consumer.c -o ${BUILD_DIR}/usb_consumer.o
 avr-gcc $CFLAGS $INCLUDES -c ${SRC_DIR}/script_engine.c -o ${BUILD_DIR}/script_engine.o
+avr-gcc $CFLAGS $INCLUDES -c ${SRC_DIR}/latency_probe.c -o ${BUILD_DIR}/latency_probe.o
 
 # Phase 6: Integration
 avr-gcc $CFLAGS $INCLUDES -c ${SRC_DIR}/main.c -o ${BUILD_DIR}/main.o
@@ -68,6 +79,21 @@ avr-objcopy -O ihex -R .eeprom ${BUILD_DIR}/tinykb.elf ${BUILD_DIR}/tinykb.hex
 echo "Firmware size:"
 avr-size --mcu=${MCU} -C ${BUILD_DIR}/tinykb.elf
 
+# Flash image is .text + .data, static RAM is .data + .bss
+FLASH_USED=$(avr-size ${BUILD_DIR}/tinykb.elf | awk 'NR == 2 { print $1 + $2 }')
+RAM_USED=$(avr-size ${BUILD_DIR}/tinykb.elf | awk 'NR == 2 { print $2 + $3 }')
+STACK_LEFT=$((512 - RAM_USED))
+echo "Stack space left: ${STACK_LEFT} bytes"
+
+if [ "${FLASH_USED}" -gt "${MAX_FLASH}" ]; then
+    echo "Error: ${FLASH_USED} bytes of flash used, ${MAX_FLASH} available"
+    exit 1
+fi
+if [ "${STACK_LEFT}" -lt "${MIN_STACK}" ]; then
+    echo "Error: ${STACK_LEFT} bytes left for the stack, ${MIN_STACK} required"
+    exit 1
+fi
+
 echo ""
 echo "Build completed -> ${BUILD_DIR}/tinykb.hex"
 echo ""
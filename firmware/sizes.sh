@@ -0,0 +1,47 @@
+#!/bin/bash
+# TinyKB Firmware Size Report
+#
+# Builds the default image and every combination of the optional features
+# (see src/config.h) and prints flash and static RAM of each as a markdown
+# table for docs/architecture.md. Builds over the limits are reported, not
+# rejected; build.sh enforces them for the image that gets flashed.
+
+set -e
+
+FLAGS="STRING_HID STRING_PACKED COMPRESSED CONSUMER LATENCY_PROBE"
+MAX_FLASH=${MAX_FLASH:-6012}
+MIN_STACK=${MIN_STACK:-96}
+SIZES_DIR=build/sizes
+
+echo "| Features | Flash (bytes) | RAM (bytes) | Stack left | Fits |"
+echo "|----------|---------------|-------------|------------|------|"
+
+COUNT=$(echo ${FLAGS} | wc -w)
+for ((MASK = 0; MASK < (1 << COUNT); MASK++)); do
+    FEATURES=""
+    NAMES=""
+    BIT=0
+    for FLAG in ${FLAGS}; do
+        if (( (MASK >> BIT) & 1 )); then
+            FEATURES="${FEATURES} -DFEATURE_${FLAG}=1"
+            NAMES="${NAMES:+${NAMES}, }${FLAG}"
+        fi
+        BIT=$((BIT + 1))
+    done
+
+    # Fresh directory per image, limits lifted so every combination links
+    BUILD_DIR=${SIZES_DIR}/${MASK}
+    rm -rf ${BUILD_DIR}
+    BUILD_DIR=${BUILD_DIR} FEATURES="${FEATURES}" MAX_FLASH=65535 MIN_STACK=-65535 bash build.sh > /dev/null
+
+    FLASH_USED=$(avr-size ${BUILD_DIR}/tinykb.elf | awk 'NR == 2 { print $1 + $2 }')
+    RAM_USED=$(avr-size ${BUILD_DIR}/tinykb.elf | awk 'NR == 2 { print $2 + $3 }')
+    STACK_LEFT=$((512 - RAM_USED))
+
+    FITS=yes
+    if [ "${FLASH_USED}" -gt "${MAX_FLASH}" ] || [ "${STACK_LEFT}" -lt "${MIN_STACK}" ]; then
+        FITS=no
+    fi
+
+    echo "| ${NAMES:-default} | ${FLASH_USED} | ${RAM_USED} | ${STACK_LEFT} | ${FITS} |"
+done
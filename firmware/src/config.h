@@ -19,7 +19,12 @@
 /* -------------------------------------------------------------------------- */
 
 #define PROTOCOL_REPORT_SIZE      32    /* HID report size in bytes    */
-#define PROTOCOL_FIRMWARE_VERSION 0x01  /* Firmware version for STATUS */
+#define PROTOCOL_FIRMWARE_VERSION 0x02  /* Firmware version for STATUS */
+
+/* HID report IDs (first byte of every report on the wire) */
+#define PROTOCOL_REPORT_ID_COMMAND 0x01 /* Command / response report */
+#define PROTOCOL_REPORT_ID_BULK   0x02  /* Whole-script feature report */
+#define PROTOCOL_REPORT_ID_CONSUMER 0x03 /* Consumer control input (EP3) */
 
 /* -------------------------------------------------------------------------- */
 /* Storage Header Layout                                                      */
@@ -37,13 +42,22 @@
 /* Header validation */
 #define STORAGE_PAYLOAD_VERSION   0x1A  /* Payload format version */
 
+/* Header FLAGS bits */
+#define HEADER_FLAG_BURST_TYPING  0x01  /* Overlap STRING keystrokes */
+#define HEADER_FLAG_FAST_BOOT     0x02  /* Short USB disconnect, no connect blink */
+#define HEADER_FLAG_ADAPTIVE_RATE 0x04  /* Pace STRING typing by host LED echo latency */
+#define HEADER_FLAG_NKRO          0x08  /* Enumerate with an N-key rollover report */
+#define HEADER_FLAG_COMPRESSED    0x10  /* Bytecode stored as an LZ token stream */
+
 /* -------------------------------------------------------------------------- */
 /* Storage Layout (Derived)                                                   */
 /* -------------------------------------------------------------------------- */
 
 #define STORAGE_EEPROM_SIZE       HW_EEPROM_SIZE
 #define STORAGE_SCRIPT_START      STORAGE_HEADER_SIZE
-#define STORAGE_MAX_SCRIPT_SIZE   (STORAGE_EEPROM_SIZE - STORAGE_HEADER_SIZE)
+#define STORAGE_OSCCAL_ADDRESS    (STORAGE_EEPROM_SIZE - 1)   /* Cached OSCCAL */
+#define STORAGE_MAX_SCRIPT_SIZE   (STORAGE_OSCCAL_ADDRESS - STORAGE_SCRIPT_START)
+#define STORAGE_HOST_LIMIT        STORAGE_OSCCAL_ADDRESS      /* End of host-addressable range */
 
 /* -------------------------------------------------------------------------- */
 /* Protocol Data Limits (Derived)                                             */
@@ -53,12 +67,49 @@
 #define PROTOCOL_WRITE_OVERHEAD   5     /* cmd(1) + addr(2) + len(2) */
 #define PROTOCOL_READ_OVERHEAD    3     /* status(1) + bytes_read(2) */
 #define PROTOCOL_APPEND_OVERHEAD  3     /* cmd(1) + len(2)           */
+#define PROTOCOL_HASH_OVERHEAD    3     /* status(1) + start(1) + count(1) */
 
 /* Maximum data payload per command (report size - overhead) */
 #define PROTOCOL_MAX_WRITE_DATA   (PROTOCOL_REPORT_SIZE - PROTOCOL_WRITE_OVERHEAD)
 #define PROTOCOL_MAX_READ_DATA    (PROTOCOL_REPORT_SIZE - PROTOCOL_READ_OVERHEAD)
 #define PROTOCOL_MAX_APPEND_DATA  (PROTOCOL_REPORT_SIZE - PROTOCOL_APPEND_OVERHEAD)
 
+/* Bulk report: length(2) + whole script area */
+#define PROTOCOL_BULK_HEADER_SIZE 2
+#define PROTOCOL_BULK_REPORT_SIZE (PROTOCOL_BULK_HEADER_SIZE + STORAGE_MAX_SCRIPT_SIZE)
+
+/* HASH blocks (script area split into fixed-size blocks, last one shorter) */
+#define PROTOCOL_HASH_BLOCK_SIZE  32
+#define PROTOCOL_HASH_BLOCK_COUNT ((STORAGE_MAX_SCRIPT_SIZE + PROTOCOL_HASH_BLOCK_SIZE - 1) / PROTOCOL_HASH_BLOCK_SIZE)
+#define PROTOCOL_MAX_HASH_BLOCKS  ((PROTOCOL_REPORT_SIZE - PROTOCOL_HASH_OVERHEAD) / 2)
+
+/* -------------------------------------------------------------------------- */
+/* Optional Features                                                          */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * Off by default to keep the Micronucleus build within its ~6 KB of flash.
+ * Enable with FEATURES="-DFEATURE_...=1" ./build.sh for ISP-flashed boards.
+ * Scripts using a disabled opcode or header flag stop with ENGINE_ERROR,
+ * and disabled protocol commands answer INVALID_COMMAND. Modules only a
+ * disabled feature calls are still compiled; --gc-sections drops them.
+ */
+#ifndef FEATURE_STRING_HID
+#define FEATURE_STRING_HID        0     /* STRING_HID opcode (0x0C)    */
+#endif
+#ifndef FEATURE_STRING_PACKED
+#define FEATURE_STRING_PACKED     0     /* STRING_PACKED opcode (0x0D) */
+#endif
+#ifndef FEATURE_COMPRESSED
+#define FEATURE_COMPRESSED        0     /* HEADER_FLAG_COMPRESSED scripts */
+#endif
+#ifndef FEATURE_CONSUMER
+#define FEATURE_CONSUMER          0     /* CONSUMER opcode (0x0B)      */
+#endif
+#ifndef FEATURE_LATENCY_PROBE
+#define FEATURE_LATENCY_PROBE     0     /* LATENCY_PROBE/RESULT commands */
+#endif
+
 /* -------------------------------------------------------------------------- */
 /* CRC Configuration                                                          */
 /* -------------------------------------------------------------------------- */
@@ -1,28 +1,26 @@
 /**
  * device_mode.c - Device mode state machine
  *
- * Handles mode detection at startup, USB initialization, and runs the
- * appropriate mode loop (programming or keyboard).
+ * Handles USB initialization and runs the main loop. The device always
+ * enumerates as a composite keyboard + raw HID device; the mode only
+ * decides whether the script engine or the programming protocol is active.
  */
 
 #include "device_mode.h"
+#include "config.h"
 #include "eeprom_storage.h"
 #include "usb_core.h"
 #include "usb_keyboard.h"
+#include "usb_consumer.h"
 #include "usb_rawhid.h"
 #include "script_engine.h"
-#include "timer.h"
 #include "led.h"
+#include "oscillator.h"
+#include "latency_probe.h"
 
 #include <avr/io.h>
 #include <avr/wdt.h>
 
-/* -------------------------------------------------------------------------- */
-/* Constants                                                                  */
-/* -------------------------------------------------------------------------- */
-
-#define PROGRAMMING_TIMEOUT_MS  5000
-
 /* -------------------------------------------------------------------------- */
 /* Types                                                                      */
 /* -------------------------------------------------------------------------- */
@@ -40,57 +38,31 @@ typedef enum {
 
 static device_mode_t current_mode;
 
-/* Mode Detection */
-
-static device_mode_t determine_initial_mode(void) {
-    uint8_t reset_source = MCUSR;
-    if (reset_source == 0) {
-        reset_source = GPIOR0;
-    }
-    MCUSR = 0;
-    wdt_disable();
-
-    if (reset_source & _BV(WDRF)) {
-        return DEVICE_MODE_KEYBOARD;
-    }
+/* Mode Transitions */
 
-    return DEVICE_MODE_PROGRAMMING;
+static void enter_programming(void) {
+    engine_stop();
+    led_on();
+    current_mode = DEVICE_MODE_PROGRAMMING;
 }
 
-static void trigger_watchdog_reset(void) {
-    wdt_enable(WDTO_15MS);
-    for (;;) {
-        /* Wait for watchdog reset */
-    }
-}
+/* Main Loop */
 
-/* Mode Loops */
+static void run_device_loop(void) {
+    /* Boot policy from the stored script header (0 without a valid script) */
+    uint8_t flags = storage_get_flags();
+    bool fast_boot = (flags & HEADER_FLAG_FAST_BOOT) != 0;
 
-static void run_programming_loop(void) {
-    usb_init();
+    usb_init(fast_boot);
+    keyboard_init((flags & HEADER_FLAG_NKRO) != 0);
+#if FEATURE_CONSUMER
+    consumer_init();
+#endif
     rawhid_init();
-
-    led_on();
-
-    uint16_t timeout_start = timer_millis();
-
-    for (;;) {
-        usb_poll();
-
-        if (rawhid_should_exit()) {
-            device_mode_transition_to_keyboard();
-        }
-
-        if (!rawhid_had_activity() && timer_elapsed(timeout_start, PROGRAMMING_TIMEOUT_MS)) {
-            device_mode_transition_to_keyboard();
-        }
-    }
-}
-
-static void run_keyboard_loop(void) {
-    usb_init();
-    keyboard_init();
     engine_init();
+#if FEATURE_LATENCY_PROBE
+    latency_init();
+#endif
 
     led_off();
 
@@ -98,12 +70,32 @@ static void run_keyboard_loop(void) {
         usb_poll();
     }
 
-    led_blink(2, 80, 80, usb_poll);
+    if (!fast_boot) {
+        led_blink(2, 80, 80, usb_poll);
+    }
     engine_start();
 
     for (;;) {
         usb_poll();
-        engine_tick();
+        storage_tick();
+        oscillator_track();
+        oscillator_persist();
+#if FEATURE_LATENCY_PROBE
+        latency_tick();   /* Probe run, or a restore tap left by a cancelled one */
+#endif
+
+        if (current_mode == DEVICE_MODE_KEYBOARD) {
+            if (rawhid_had_activity()) {
+                enter_programming();
+            } else {
+                engine_tick();
+            }
+        } else if (!rawhid_should_exit()) {
+            rawhid_tick();
+        } else if (storage_is_idle()) {
+            /* EXIT: keep polling USB until queued writes have landed */
+            device_mode_transition_to_keyboard();
+        }
     }
 }
 
@@ -114,15 +106,13 @@ static void run_keyboard_loop(void) {
 /* Lifecycle */
 
 void device_mode_init(void) {
-    current_mode = determine_initial_mode();
+    MCUSR = 0;
+    wdt_disable();
+    current_mode = DEVICE_MODE_KEYBOARD;
 }
 
 void device_mode_run(void) {
-    if (current_mode == DEVICE_MODE_KEYBOARD) {
-        run_keyboard_loop();
-    } else {
-        run_programming_loop();
-    }
+    run_device_loop();
 }
 
 /* Mode Queries */
@@ -138,5 +128,13 @@ bool device_mode_is_keyboard(void) {
 /* Mode Transitions */
 
 void device_mode_transition_to_keyboard(void) {
-    trigger_watchdog_reset();
+#if FEATURE_LATENCY_PROBE
+    latency_cancel();
+#endif
+    storage_flush();
+    storage_init();   /* WRITE or ERASE_RANGE may have changed the header */
+    rawhid_init();
+    led_off();
+    current_mode = DEVICE_MODE_KEYBOARD;
+    engine_start();
 }
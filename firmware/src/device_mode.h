@@ -1,12 +1,13 @@
 /**
  * device_mode.h - Device mode state machine
  *
- * Manages device mode transitions between Programming and Keyboard modes.
- * Uses MCUSR/GPIOR0 watchdog reset detection for mode selection.
+ * Manages device mode transitions between Programming and Keyboard modes
+ * without re-enumerating (composite keyboard + raw HID device).
  *
- * Mode Detection:
- *   - Watchdog reset (WDRF in MCUSR/GPIOR0) -> Keyboard mode
- *   - Any other reset source -> Programming mode (5s timeout)
+ * Mode Transitions:
+ *   - Power-on -> Keyboard mode, script starts after enumeration
+ *   - Raw HID SET_REPORT -> Programming mode, script stopped
+ *   - EXIT command -> Keyboard mode, script restarted
  */
 
 #ifndef DEVICE_MODE_H
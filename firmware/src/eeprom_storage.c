@@ -2,13 +2,20 @@
  * eeprom_storage.c - EEPROM storage abstraction
  *
  * Provides unified access to EEPROM using absolute addresses.
- * Uses eeprom_update_byte() for writes to extend EEPROM lifespan.
+ * Writes go through a write-behind queue drained by storage_tick() from the
+ * main loop, one byte each time the EEPROM is ready. No interrupt is used,
+ * so nothing can delay the V-USB interrupt. Bytes that already hold the
+ * value are skipped to extend EEPROM lifespan, and split erase-only/
+ * write-only programming (~1.8 ms) is used instead of atomic erase+write
+ * (~3.4 ms) when possible.
  */
 
 #include "eeprom_storage.h"
 #include "config.h"
 #include "crc16.h"
 
+#include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/eeprom.h>
 
 /* -------------------------------------------------------------------------- */
@@ -24,6 +31,71 @@ static struct {
     bool     valid;
 } cache;
 
+/* Write-behind queue: a contiguous run of bytes starting at 'address' */
+
+static struct {
+    uint8_t data[STORAGE_QUEUE_SIZE];
+    uint16_t address;
+    uint8_t tail;
+    uint8_t count;
+} queue;
+
+/* Pending erase run, processed before the queue */
+
+static struct {
+    uint16_t address;
+    uint16_t remaining;
+} erase;
+
+/* Programming */
+
+static void program_byte(uint16_t address, uint8_t value) {
+    EEAR = address;
+    EECR |= _BV(EERE);
+
+    uint8_t current = EEDR;
+    if (current == value) {
+        return;
+    }
+
+    /* Erase-only to reach 0xFF, write-only when just clearing bits */
+    uint8_t mode = 0;
+    if (value == 0xFF) {
+        mode = _BV(EEPM0);
+    } else if ((current & value) == value) {
+        mode = _BV(EEPM1);
+    }
+    EECR = (EECR & ~(_BV(EEPM1) | _BV(EEPM0))) | mode;
+
+    EEDR = value;
+    cli();
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+    sei();
+}
+
+static bool queue_accepts(uint16_t address, uint8_t length) {
+    /* The queue holds one contiguous run */
+    if (queue.count == 0) {
+        return length <= STORAGE_QUEUE_SIZE;
+    }
+    return queue.address + queue.count == address &&
+           length <= STORAGE_QUEUE_SIZE - queue.count;
+}
+
+static void queue_byte(uint16_t address, uint8_t value) {
+    /* Callers check storage_can_queue() first, so this rarely waits */
+    while (!queue_accepts(address, 1)) {
+        storage_tick();
+    }
+
+    if (queue.count == 0) {
+        queue.address = address;
+    }
+    queue.data[(queue.tail + queue.count) % STORAGE_QUEUE_SIZE] = value;
+    queue.count++;
+}
+
 /* Helpers */
 
 static uint16_t read_u16(uint16_t addr) {
@@ -33,8 +105,8 @@ static uint16_t read_u16(uint16_t addr) {
 }
 
 static void write_u16(uint16_t addr, uint16_t value) {
-    eeprom_update_byte((uint8_t *)addr, value & 0xFF);
-    eeprom_update_byte((uint8_t *)(addr + 1), (value >> 8) & 0xFF);
+    queue_byte(addr, value & 0xFF);
+    queue_byte(addr + 1, (value >> 8) & 0xFF);
 }
 
 static bool validate_header(void) {
@@ -69,18 +141,21 @@ uint8_t storage_read_byte(uint16_t address) {
     if (address >= STORAGE_EEPROM_SIZE) {
         return 0xFF;
     }
+    storage_flush();
     return eeprom_read_byte((const uint8_t *)address);
 }
 
 void storage_write_byte(uint16_t address, uint8_t value) {
     if (address < STORAGE_EEPROM_SIZE) {
-        eeprom_update_byte((uint8_t *)address, value);
+        queue_byte(address, value);
     }
 }
 
 /* Block Access */
 
 void storage_read_bytes(uint16_t address, uint8_t *buffer, uint16_t length) {
+    storage_flush();
+
     for (uint16_t i = 0; i < length; i++) {
         if (address + i >= STORAGE_EEPROM_SIZE) {
             buffer[i] = 0xFF;
@@ -93,16 +168,71 @@ void storage_read_bytes(uint16_t address, uint8_t *buffer, uint16_t length) {
 void storage_write_bytes(uint16_t address, const uint8_t *data, uint16_t length) {
     for (uint16_t i = 0; i < length; i++) {
         if (address + i < STORAGE_EEPROM_SIZE) {
-            eeprom_update_byte((uint8_t *)(address + i), data[i]);
+            queue_byte(address + i, data[i]);
         }
     }
 }
 
+/* Write-Behind Queue */
+
+void storage_erase_bytes(uint16_t address, uint16_t length) {
+    if (address >= STORAGE_EEPROM_SIZE) {
+        return;
+    }
+    if (length > STORAGE_EEPROM_SIZE - address) {
+        length = STORAGE_EEPROM_SIZE - address;
+    }
+
+    /* Queued writes must land before the erase run starts */
+    storage_flush();
+
+    erase.address = address;
+    erase.remaining = length;
+}
+
+bool storage_can_queue(uint16_t address, uint8_t length) {
+    return erase.remaining == 0 && queue_accepts(address, length);
+}
+
+uint16_t storage_pending_writes(void) {
+    return erase.remaining + queue.count;
+}
+
+bool storage_is_idle(void) {
+    return storage_pending_writes() == 0 && !(EECR & _BV(EEPE));
+}
+
+void storage_tick(void) {
+    if (EECR & _BV(EEPE)) {
+        return;
+    }
+
+    if (erase.remaining > 0) {
+        program_byte(erase.address++, 0xFF);
+        erase.remaining--;
+    } else if (queue.count > 0) {
+        uint16_t address = queue.address;
+        uint8_t value = queue.data[queue.tail];
+
+        queue.address = address + 1;
+        queue.tail = (queue.tail + 1) % STORAGE_QUEUE_SIZE;
+        queue.count--;
+
+        program_byte(address, value);
+    }
+}
+
+void storage_flush(void) {
+    while (!storage_is_idle()) {
+        storage_tick();
+    }
+}
+
 /* Header Operations */
 
 void storage_write_header(uint8_t version, uint8_t flags, uint16_t delay, uint16_t length, uint16_t crc) {
-    eeprom_update_byte((uint8_t *)HEADER_OFFSET_VERSION, version);
-    eeprom_update_byte((uint8_t *)HEADER_OFFSET_FLAGS, flags);
+    queue_byte(HEADER_OFFSET_VERSION, version);
+    queue_byte(HEADER_OFFSET_FLAGS, flags);
     write_u16(HEADER_OFFSET_DELAY, delay);
     write_u16(HEADER_OFFSET_LENGTH, length);
     write_u16(HEADER_OFFSET_CRC, crc);
@@ -125,11 +255,15 @@ uint16_t storage_get_script_length(void) {
     return cache.valid ? cache.length : 0;
 }
 
-uint16_t storage_get_initial_delay(void) {
+uint32_t storage_get_initial_delay(void) {
     if (!cache.valid) {
         return 0;
     }
-    return cache.delay * 100;
+    return (uint32_t)cache.delay * 100;
+}
+
+uint8_t storage_get_flags(void) {
+    return cache.valid ? cache.flags : 0;
 }
 
 /* Script Validation */
@@ -138,17 +272,19 @@ bool storage_has_valid_script(void) {
     return cache.valid;
 }
 
-bool storage_verify_crc(uint16_t length, uint16_t expected_crc) {
-    if (length == 0 || length > STORAGE_MAX_SCRIPT_SIZE) {
-        return false;
-    }
-
+uint16_t storage_compute_crc(uint16_t address, uint16_t length) {
     uint16_t crc = crc16_init();
     for (uint16_t i = 0; i < length; i++) {
-        uint8_t byte = storage_read_byte(STORAGE_SCRIPT_START + i);
+        uint8_t byte = storage_read_byte(address + i);
         crc = crc16_update(crc, byte);
     }
-    crc = crc16_finalize(crc);
+    return crc16_finalize(crc);
+}
+
+bool storage_verify_crc(uint16_t length, uint16_t expected_crc) {
+    if (length == 0 || length > STORAGE_MAX_SCRIPT_SIZE) {
+        return false;
+    }
 
-    return crc == expected_crc;
+    return storage_compute_crc(STORAGE_SCRIPT_START, length) == expected_crc;
 }
@@ -5,10 +5,16 @@
  *
  * EEPROM layout (512 bytes):
  *   [0x000 - 0x007] Header (8 bytes)
- *   [0x008 - 0x1FF] Script data (504 bytes max)
+ *   [0x008 - 0x1FE] Script data (503 bytes max)
+ *   [0x1FF]         Cached OSCCAL value
  *
  * Header format (8 bytes):
  *   version(1) + flags(1) + delay(2) + length(2) + crc16(2)
+ *
+ * Writes are queued and programmed in the background by storage_tick(),
+ * called from the main loop. Reads wait for pending writes so they always
+ * see queued data; USB callbacks check storage_pending_writes() or
+ * storage_can_queue() first so they never wait.
  */
 
 #ifndef EEPROM_STORAGE_H
@@ -17,6 +23,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* -------------------------------------------------------------------------- */
+/* Constants                                                                  */
+/* -------------------------------------------------------------------------- */
+
+#define STORAGE_QUEUE_SIZE 32   /* Write-behind queue size in bytes */
+
 /* -------------------------------------------------------------------------- */
 /* Public API                                                                 */
 /* -------------------------------------------------------------------------- */
@@ -35,6 +47,15 @@ void storage_write_byte(uint16_t address, uint8_t value);
 void storage_read_bytes(uint16_t address, uint8_t *buffer, uint16_t length);
 void storage_write_bytes(uint16_t address, const uint8_t *data, uint16_t length);
 
+/* Write-Behind Queue */
+
+void storage_erase_bytes(uint16_t address, uint16_t length);
+bool storage_can_queue(uint16_t address, uint8_t length);
+uint16_t storage_pending_writes(void);
+bool storage_is_idle(void);
+void storage_tick(void);
+void storage_flush(void);
+
 /* Header Operations */
 
 void storage_write_header(uint8_t version, uint8_t flags, uint16_t delay, uint16_t length, uint16_t crc);
@@ -43,11 +64,13 @@ void storage_invalidate_script(void);
 /* Script Metadata */
 
 uint16_t storage_get_script_length(void);
-uint16_t storage_get_initial_delay(void);
+uint32_t storage_get_initial_delay(void);
+uint8_t storage_get_flags(void);
 
 /* Validation */
 
 bool storage_has_valid_script(void);
+uint16_t storage_compute_crc(uint16_t address, uint16_t length);
 bool storage_verify_crc(uint16_t length, uint16_t expected_crc);
 
 #endif /* EEPROM_STORAGE_H */
@@ -10,6 +10,8 @@
 #include "hid_protocol.h"
 #include "eeprom_storage.h"
 #include "crc16.h"
+#include "oscillator.h"
+#include "latency_probe.h"
 #include <string.h>
 
 /* -------------------------------------------------------------------------- */
@@ -18,10 +20,21 @@
 
 /* State */
 
-static uint8_t response[PROTOCOL_REPORT_SIZE];
+/* Input report: report ID followed by the response, built in place */
+static uint8_t response_report[1 + PROTOCOL_REPORT_SIZE];
+static uint8_t *const response = &response_report[1];
 static uint8_t response_length;
+static uint8_t header[PROTOCOL_HEADER_SIZE];
+static uint8_t header_length;
+static uint8_t report_position;
+static bool command_started;
+static uint16_t stream_address;
+static uint16_t stream_remaining;
+static bool stream_crc;
 static uint16_t current_offset;
 static uint16_t running_crc;
+static uint16_t bulk_position;
+static uint16_t bulk_length;
 static bool exit_requested;
 
 /* Helpers */
@@ -45,6 +58,15 @@ static void write_le16(uint8_t *data, uint16_t value) {
     data[1] = (uint8_t)(value >> 8);
 }
 
+static bool reject_if_busy(void) {
+    /* USB callbacks must not wait for EEPROM programming */
+    if (storage_is_idle()) {
+        return false;
+    }
+    set_error_response(PROTOCOL_STATUS_BUSY);
+    return true;
+}
+
 /* Command Handlers */
 
 static void handle_write_command(const uint8_t *report) {
@@ -52,20 +74,28 @@ static void handle_write_command(const uint8_t *report) {
     uint16_t length = read_le16(&report[3]);
 
     /* Validate address (absolute EEPROM address) */
-    if (address >= STORAGE_EEPROM_SIZE) {
+    if (address >= STORAGE_HOST_LIMIT) {
         set_error_response(PROTOCOL_STATUS_INVALID_ADDRESS);
         return;
     }
 
     /* Validate length */
     if (length == 0 || length > PROTOCOL_MAX_WRITE_DATA ||
-        (address + length) > STORAGE_EEPROM_SIZE) {
+        (address + length) > STORAGE_HOST_LIMIT) {
         set_error_response(PROTOCOL_STATUS_INVALID_LENGTH);
         return;
     }
 
-    /* Write bytes to EEPROM (absolute address) */
-    storage_write_bytes(address, &report[5], length);
+    /* The whole payload must fit the queue, so streaming never waits */
+    if (!storage_can_queue(address, (uint8_t)length)) {
+        set_error_response(PROTOCOL_STATUS_BUSY);
+        return;
+    }
+
+    /* Payload is streamed to EEPROM (absolute address) as it arrives */
+    stream_address = address;
+    stream_remaining = length;
+    stream_crc = false;
 
     /* Response: status(1) + bytes_written(2) */
     response[0] = PROTOCOL_STATUS_OK;
@@ -73,23 +103,96 @@ static void handle_write_command(const uint8_t *report) {
     response_length = 3;
 }
 
+static void handle_erase_range_command(const uint8_t *report) {
+    uint16_t address = read_le16(&report[1]);
+    uint16_t length = read_le16(&report[3]);
+
+    /* Validate address (absolute EEPROM address) */
+    if (address >= STORAGE_HOST_LIMIT) {
+        set_error_response(PROTOCOL_STATUS_INVALID_ADDRESS);
+        return;
+    }
+
+    /* Validate length */
+    if (length == 0 || (address + length) > STORAGE_HOST_LIMIT) {
+        set_error_response(PROTOCOL_STATUS_INVALID_LENGTH);
+        return;
+    }
+
+    if (reject_if_busy()) {
+        return;
+    }
+
+    /* Start erase-only programming in the background */
+    storage_erase_bytes(address, length);
+
+    /* Response: status(1) + bytes_erased(2) */
+    response[0] = PROTOCOL_STATUS_OK;
+    write_le16(&response[1], length);
+    response_length = 3;
+}
+
+static void handle_hash_command(const uint8_t *report) {
+    uint8_t start_block = report[1];
+    uint8_t count = report[2];
+
+    /* Validate start block */
+    if (start_block >= PROTOCOL_HASH_BLOCK_COUNT) {
+        set_error_response(PROTOCOL_STATUS_INVALID_ADDRESS);
+        return;
+    }
+
+    /* Validate block count */
+    if (count == 0 || count > PROTOCOL_MAX_HASH_BLOCKS ||
+        (start_block + count) > PROTOCOL_HASH_BLOCK_COUNT) {
+        set_error_response(PROTOCOL_STATUS_INVALID_LENGTH);
+        return;
+    }
+
+    if (reject_if_busy()) {
+        return;
+    }
+
+    /* Response: status(1) + start_block(1) + count(1) + crc16(2) * count */
+    response[0] = PROTOCOL_STATUS_OK;
+    response[1] = start_block;
+    response[2] = count;
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t offset = (uint16_t)(start_block + i) * PROTOCOL_HASH_BLOCK_SIZE;
+        uint16_t length = STORAGE_MAX_SCRIPT_SIZE - offset;
+        if (length > PROTOCOL_HASH_BLOCK_SIZE) {
+            length = PROTOCOL_HASH_BLOCK_SIZE;
+        }
+
+        uint16_t crc = storage_compute_crc(STORAGE_SCRIPT_START + offset, length);
+        write_le16(&response[PROTOCOL_HASH_OVERHEAD + 2 * i], crc);
+    }
+
+    response_length = PROTOCOL_HASH_OVERHEAD + 2 * count;
+}
+
 static void handle_read_command(const uint8_t *report) {
     uint16_t address = read_le16(&report[1]);
     uint16_t length = read_le16(&report[3]);
 
     /* Validate address (absolute EEPROM address) */
-    if (address >= STORAGE_EEPROM_SIZE) {
+    if (address >= STORAGE_HOST_LIMIT) {
         set_error_response(PROTOCOL_STATUS_INVALID_ADDRESS);
         return;
     }
 
     /* Validate length */
     if (length == 0 || length > PROTOCOL_MAX_READ_DATA ||
-        (address + length) > STORAGE_EEPROM_SIZE) {
+        (address + length) > STORAGE_HOST_LIMIT) {
         set_error_response(PROTOCOL_STATUS_INVALID_LENGTH);
         return;
     }
 
+    if (reject_if_busy()) {
+        return;
+    }
+
     /* Response: status(1) + bytes_read(2) + data(N) */
     response[0] = PROTOCOL_STATUS_OK;
     write_le16(&response[1], length);
@@ -100,6 +203,33 @@ static void handle_read_command(const uint8_t *report) {
     response_length = 3 + (uint8_t)length;
 }
 
+static void handle_verify_command(const uint8_t *report) {
+    uint16_t address = read_le16(&report[1]);
+    uint16_t length = read_le16(&report[3]);
+
+    /* Validate address (absolute EEPROM address) */
+    if (address >= STORAGE_HOST_LIMIT) {
+        set_error_response(PROTOCOL_STATUS_INVALID_ADDRESS);
+        return;
+    }
+
+    /* Validate length */
+    if (length == 0 || (address + length) > STORAGE_HOST_LIMIT) {
+        set_error_response(PROTOCOL_STATUS_INVALID_LENGTH);
+        return;
+    }
+
+    if (reject_if_busy()) {
+        return;
+    }
+
+    /* Response: status(1) + bytes_verified(2) + crc16(2) */
+    response[0] = PROTOCOL_STATUS_OK;
+    write_le16(&response[1], length);
+    write_le16(&response[3], storage_compute_crc(address, length));
+    response_length = 5;
+}
+
 static void handle_append_command(const uint8_t *report) {
     uint16_t length = read_le16(&report[1]);
 
@@ -110,20 +240,25 @@ static void handle_append_command(const uint8_t *report) {
         return;
     }
 
-    /* Write bytes and update CRC */
-    for (uint16_t i = 0; i < length; i++) {
-        uint8_t byte = report[3 + i];
-        storage_write_byte(STORAGE_SCRIPT_START + current_offset + i, byte);
-        running_crc = crc16_update(running_crc, byte);
+    /* The whole payload must fit the queue, so streaming never waits */
+    if (!storage_can_queue(STORAGE_SCRIPT_START + current_offset, (uint8_t)length)) {
+        set_error_response(PROTOCOL_STATUS_BUSY);
+        return;
     }
 
-    current_offset += length;
+    /* Payload is streamed to EEPROM and CRC as it arrives */
+    stream_address = STORAGE_SCRIPT_START + current_offset;
+    stream_remaining = length;
+    stream_crc = true;
 
-    /* Response: status(1) + next_offset(2) + running_crc(2) */
+    /* Response: status(1) + next_offset(2) + running_crc(2), set by finish_append */
     response[0] = PROTOCOL_STATUS_OK;
+    response_length = 5;
+}
+
+static void finish_append_command(void) {
     write_le16(&response[1], current_offset);
     write_le16(&response[3], running_crc);
-    response_length = 5;
 }
 
 static void handle_reset_command(void) {
@@ -147,16 +282,16 @@ static void handle_commit_command(const uint8_t *report) {
         return;
     }
 
+    /* The header is a separate run, and the CRC may read storage */
+    if (reject_if_busy()) {
+        return;
+    }
+
     /* Calculate CRC based on options */
     uint16_t calculated_crc;
     if (options & PROTOCOL_OPT_CRC_FROM_EEPROM) {
         /* Read EEPROM and calculate CRC */
-        calculated_crc = crc16_init();
-        for (uint16_t i = 0; i < length; i++) {
-            uint8_t byte = storage_read_byte(STORAGE_SCRIPT_START + i);
-            calculated_crc = crc16_update(calculated_crc, byte);
-        }
-        calculated_crc = crc16_finalize(calculated_crc);
+        calculated_crc = storage_compute_crc(STORAGE_SCRIPT_START, length);
     } else {
         /* Use running CRC */
         calculated_crc = crc16_finalize(running_crc);
@@ -181,58 +316,81 @@ static void handle_commit_command(const uint8_t *report) {
 }
 
 static void handle_status_command(void) {
-    memset(response, 0, sizeof(response));
-
     response[0] = PROTOCOL_STATUS_OK;
     response[1] = PROTOCOL_FIRMWARE_VERSION;           /* FwVersion */
     write_le16(&response[2], STORAGE_EEPROM_SIZE);     /* EEPROMSize */
     response[4] = PROTOCOL_REPORT_SIZE;                /* ReportSize */
     write_le16(&response[5], running_crc);             /* RunningCRC */
     write_le16(&response[7], current_offset);          /* CurrentOffset */
+    write_le16(&response[9], storage_pending_writes()); /* PendingWrites */
+    write_le16(&response[11], (uint16_t)oscillator_get_drift()); /* OscDrift */
+    write_le16(&response[13], oscillator_get_adjustments()); /* OscAdjustments */
 
     response_length = PROTOCOL_REPORT_SIZE;
 }
 
-static void handle_exit_command(void) {
-    exit_requested = true;
-    /* No response - device will reset */
-    response_length = 0;
+#if FEATURE_LATENCY_PROBE
+static void handle_latency_probe_command(const uint8_t *report) {
+    if (!latency_start(report[1])) {
+        set_error_response(PROTOCOL_STATUS_INVALID_LENGTH);
+        return;
+    }
+
+    set_ok_response();
 }
 
-/* -------------------------------------------------------------------------- */
-/* Public                                                                     */
-/* -------------------------------------------------------------------------- */
+static void handle_latency_result_command(void) {
+    latency_result_t result;
+    latency_get_result(&result);
 
-/* Lifecycle */
+    response[0] = PROTOCOL_STATUS_OK;
+    response[1] = (uint8_t)result.state;               /* State */
+    response[2] = result.requested;                    /* Requested */
+    response[3] = result.taken;                        /* Samples */
+    write_le16(&response[4], result.min_ms);           /* MinMs */
+    write_le16(&response[6], result.median_ms);        /* MedianMs */
+    write_le16(&response[8], result.max_ms);           /* MaxMs */
+
+    response_length = 10;
+}
+#endif
 
-void protocol_init(void) {
-    current_offset = 0;
-    running_crc = crc16_init();
-    exit_requested = false;
+static void handle_exit_command(void) {
+    exit_requested = true;
+    /* No response - device mode restarts the script in place */
     response_length = 0;
 }
 
-/* Command Processing */
+/* Command Dispatch */
 
-void protocol_process_report(const uint8_t *report, uint8_t length) {
-    if (length == 0) {
-        set_error_response(PROTOCOL_STATUS_INVALID_COMMAND);
-        return;
+static uint8_t get_header_length(uint8_t command) {
+    switch (command) {
+        case PROTOCOL_CMD_WRITE:       return PROTOCOL_WRITE_OVERHEAD;
+        case PROTOCOL_CMD_READ:        return 5;   /* cmd(1) + addr(2) + len(2) */
+        case PROTOCOL_CMD_APPEND:      return PROTOCOL_APPEND_OVERHEAD;
+        case PROTOCOL_CMD_COMMIT:      return 10;  /* cmd(1) + opts(1) + header(8) */
+        case PROTOCOL_CMD_ERASE_RANGE: return 5;   /* cmd(1) + addr(2) + len(2) */
+        case PROTOCOL_CMD_HASH:        return 3;   /* cmd(1) + start(1) + count(1) */
+        case PROTOCOL_CMD_VERIFY:      return 5;   /* cmd(1) + addr(2) + len(2) */
+        case PROTOCOL_CMD_LATENCY_PROBE: return 2; /* cmd(1) + count(1) */
+        default:                       return 1;   /* cmd(1) */
     }
+}
 
-    uint8_t command = report[0];
+static void start_command(void) {
+    command_started = true;
 
-    switch (command) {
+    switch (header[0]) {
         case PROTOCOL_CMD_WRITE:
-            handle_write_command(report);
+            handle_write_command(header);
             break;
 
         case PROTOCOL_CMD_READ:
-            handle_read_command(report);
+            handle_read_command(header);
             break;
 
         case PROTOCOL_CMD_APPEND:
-            handle_append_command(report);
+            handle_append_command(header);
             break;
 
         case PROTOCOL_CMD_RESET:
@@ -240,7 +398,7 @@ void protocol_process_report(const uint8_t *report, uint8_t length) {
             break;
 
         case PROTOCOL_CMD_COMMIT:
-            handle_commit_command(report);
+            handle_commit_command(header);
             break;
 
         case PROTOCOL_CMD_STATUS:
@@ -251,16 +409,166 @@ void protocol_process_report(const uint8_t *report, uint8_t length) {
             handle_exit_command();
             break;
 
+        case PROTOCOL_CMD_ERASE_RANGE:
+            handle_erase_range_command(header);
+            break;
+
+        case PROTOCOL_CMD_HASH:
+            handle_hash_command(header);
+            break;
+
+        case PROTOCOL_CMD_VERIFY:
+            handle_verify_command(header);
+            break;
+
+#if FEATURE_LATENCY_PROBE
+        case PROTOCOL_CMD_LATENCY_PROBE:
+            handle_latency_probe_command(header);
+            break;
+
+        case PROTOCOL_CMD_LATENCY_RESULT:
+            handle_latency_result_command();
+            break;
+#endif
+
         default:
             set_error_response(PROTOCOL_STATUS_INVALID_COMMAND);
             break;
     }
 }
 
+/* -------------------------------------------------------------------------- */
+/* Public                                                                     */
+/* -------------------------------------------------------------------------- */
+
+/* Lifecycle */
+
+void protocol_init(void) {
+    current_offset = 0;
+    running_crc = crc16_init();
+    stream_remaining = 0;
+    response_report[0] = PROTOCOL_REPORT_ID_COMMAND;
+    exit_requested = false;
+    response_length = 0;
+}
+
+/* Command Processing */
+
+void protocol_begin_report(void) {
+    memset(header, 0, sizeof(header));
+    memset(response, 0, PROTOCOL_REPORT_SIZE);
+    header_length = 1;
+    report_position = 0;
+    command_started = false;
+    stream_remaining = 0;
+}
+
+void protocol_feed_report(const uint8_t *data, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        uint8_t byte = data[i];
+
+        /* Header: buffered until complete, then the command starts */
+        if (report_position < header_length) {
+            header[report_position++] = byte;
+            if (report_position == 1) {
+                header_length = get_header_length(byte);
+            }
+            if (report_position == header_length) {
+                start_command();
+            }
+            continue;
+        }
+
+        /* Payload: streamed straight to storage */
+        if (stream_remaining > 0) {
+            storage_write_byte(stream_address++, byte);
+            if (stream_crc) {
+                running_crc = crc16_update(running_crc, byte);
+                current_offset++;
+            }
+            stream_remaining--;
+        }
+    }
+}
+
+void protocol_end_report(void) {
+    if (report_position == 0) {
+        set_error_response(PROTOCOL_STATUS_INVALID_COMMAND);
+        return;
+    }
+
+    /* Short report: missing header bytes read as zero */
+    if (!command_started) {
+        start_command();
+    }
+
+    if (header[0] == PROTOCOL_CMD_APPEND && response[0] == PROTOCOL_STATUS_OK) {
+        finish_append_command();
+    }
+    stream_remaining = 0;
+}
+
+/* Bulk Transfer */
+
+void protocol_bulk_begin(void) {
+    bulk_position = 0;
+    bulk_length = 0;
+}
+
+void protocol_bulk_write(const uint8_t *data, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        uint16_t position = bulk_position++;
+        uint8_t byte = data[i];
+
+        /* Header: script length (LE), starts a new sequential upload */
+        if (position == 0) {
+            bulk_length = byte;
+            current_offset = 0;
+            running_crc = crc16_init();
+            continue;
+        }
+        if (position == 1) {
+            bulk_length |= (uint16_t)byte << 8;
+            if (bulk_length > STORAGE_MAX_SCRIPT_SIZE) {
+                bulk_length = STORAGE_MAX_SCRIPT_SIZE;
+            }
+            continue;
+        }
+
+        /* Data: same effect as APPEND, padding past length is ignored */
+        if (current_offset < bulk_length) {
+            storage_write_byte(STORAGE_SCRIPT_START + current_offset, byte);
+            running_crc = crc16_update(running_crc, byte);
+            current_offset++;
+        }
+    }
+}
+
+bool protocol_bulk_ready(void) {
+    /* Room for the next 8-byte packet of an upload */
+    return storage_can_queue(STORAGE_SCRIPT_START + current_offset, 8);
+}
+
+void protocol_bulk_read(uint8_t *data, uint8_t length) {
+    uint16_t script_length = storage_get_script_length();
+
+    for (uint8_t i = 0; i < length; i++) {
+        uint16_t position = bulk_position++;
+
+        if (position == 0) {
+            data[i] = (uint8_t)(script_length & 0xFF);
+        } else if (position == 1) {
+            data[i] = (uint8_t)(script_length >> 8);
+        } else {
+            data[i] = storage_read_byte(STORAGE_SCRIPT_START + position - PROTOCOL_BULK_HEADER_SIZE);
+        }
+    }
+}
+
 /* Response Access */
 
-const uint8_t* protocol_get_response(void) {
-    return response;
+const uint8_t* protocol_get_response_report(void) {
+    return response_report;
 }
 
 uint8_t protocol_get_response_length(void) {
@@ -19,13 +19,21 @@
 /* -------------------------------------------------------------------------- */
 
 /* Commands */
-#define PROTOCOL_CMD_WRITE   0x01   /* Stateless write to any address */
-#define PROTOCOL_CMD_READ    0x02   /* Stateless read from any address */
-#define PROTOCOL_CMD_APPEND  0x03   /* Stateful sequential write with CRC */
-#define PROTOCOL_CMD_RESET   0x04   /* Reset state variables */
-#define PROTOCOL_CMD_COMMIT  0x05   /* Validate CRC and write header */
-#define PROTOCOL_CMD_STATUS  0x06   /* Get device state */
-#define PROTOCOL_CMD_EXIT    0x07   /* Transition to keyboard mode */
+#define PROTOCOL_CMD_WRITE       0x01   /* Stateless write to any address */
+#define PROTOCOL_CMD_READ        0x02   /* Stateless read from any address */
+#define PROTOCOL_CMD_APPEND      0x03   /* Stateful sequential write with CRC */
+#define PROTOCOL_CMD_RESET       0x04   /* Reset state variables */
+#define PROTOCOL_CMD_COMMIT      0x05   /* Validate CRC and write header */
+#define PROTOCOL_CMD_STATUS      0x06   /* Get device state */
+#define PROTOCOL_CMD_EXIT        0x07   /* Transition to keyboard mode */
+#define PROTOCOL_CMD_ERASE_RANGE 0x08   /* Background erase of any address range */
+#define PROTOCOL_CMD_HASH        0x09   /* Per-block CRC16 of the script area */
+#define PROTOCOL_CMD_VERIFY      0x0A   /* CRC16 of any address range */
+#define PROTOCOL_CMD_LATENCY_PROBE  0x0B   /* Start a host round-trip latency run */
+#define PROTOCOL_CMD_LATENCY_RESULT 0x0C   /* Read latency run min/median/max */
+
+/* Largest fixed command header (COMMIT), payload bytes are streamed */
+#define PROTOCOL_HEADER_SIZE     10
 
 /* COMMIT Options (byte 1) */
 #define PROTOCOL_OPT_CRC_FROM_EEPROM  0x01  /* Bit 0: read EEPROM to calculate CRC */
@@ -36,6 +44,7 @@
 #define PROTOCOL_STATUS_INVALID_ADDRESS 0x02
 #define PROTOCOL_STATUS_INVALID_LENGTH  0x03
 #define PROTOCOL_STATUS_CRC_MISMATCH    0x04
+#define PROTOCOL_STATUS_BUSY            0x05   /* Storage still programming, retry */
 
 /* -------------------------------------------------------------------------- */
 /* Public API                                                                 */
@@ -47,11 +56,20 @@ void protocol_init(void);
 
 /* Command Processing */
 
-void protocol_process_report(const uint8_t *report, uint8_t length);
+void protocol_begin_report(void);
+void protocol_feed_report(const uint8_t *data, uint8_t length);
+void protocol_end_report(void);
+
+/* Bulk Transfer (streamed, PROTOCOL_REPORT_ID_BULK) */
+
+void protocol_bulk_begin(void);
+void protocol_bulk_write(const uint8_t *data, uint8_t length);
+bool protocol_bulk_ready(void);
+void protocol_bulk_read(uint8_t *data, uint8_t length);
 
 /* Response Access */
 
-const uint8_t* protocol_get_response(void);
+const uint8_t* protocol_get_response_report(void);
 uint8_t protocol_get_response_length(void);
 bool protocol_exit_requested(void);
 
@@ -0,0 +1,138 @@
+/**
+ * latency_probe.c - Host input round-trip latency probe
+ *
+ * Each sample queues a Caps Lock tap, timestamps it and waits for the
+ * host's LED output report to show the toggled state. Samples are kept
+ * sorted on insertion so min, median and max are direct lookups. A run
+ * that stops after an odd number of echoed taps, whether it completed,
+ * timed out or was cancelled, ends with one extra tap to restore Caps Lock.
+ */
+
+#include "latency_probe.h"
+#include "usb_keyboard.h"
+
+/* -------------------------------------------------------------------------- */
+/* Private                                                                    */
+/* -------------------------------------------------------------------------- */
+
+/* State */
+
+static struct {
+    uint16_t samples[LATENCY_MAX_SAMPLES];   /* Ascending */
+    keyboard_probe_t tap;
+    latency_state_t state;
+    uint8_t requested;
+    uint8_t taken;
+    bool waiting;
+    bool restore;
+} probe;
+
+/* Helpers */
+
+static void insert_sample(uint16_t rtt) {
+    uint8_t i = probe.taken;
+
+    while (i > 0 && probe.samples[i - 1] > rtt) {
+        probe.samples[i] = probe.samples[i - 1];
+        i--;
+    }
+
+    probe.samples[i] = rtt;
+    probe.taken++;
+}
+
+static void end_run(latency_state_t state) {
+    /* Odd number of echoed toggles leaves Caps Lock inverted */
+    probe.restore = (probe.taken & 1) != 0;
+    probe.waiting = false;
+    probe.state = state;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Public                                                                     */
+/* -------------------------------------------------------------------------- */
+
+/* Lifecycle */
+
+void latency_init(void) {
+    probe.state = LATENCY_IDLE;
+    probe.requested = 0;
+    probe.taken = 0;
+    probe.waiting = false;
+    probe.restore = false;
+}
+
+bool latency_start(uint8_t count) {
+    if (count == 0 || count > LATENCY_MAX_SAMPLES) {
+        return false;
+    }
+
+    /* A restore still pending from the last run goes out first */
+    probe.requested = count;
+    probe.taken = 0;
+    probe.waiting = false;
+    probe.state = LATENCY_RUNNING;
+    return true;
+}
+
+void latency_cancel(void) {
+    if (probe.state == LATENCY_RUNNING) {
+        end_run(LATENCY_TIMEOUT);
+    }
+
+    /* Queue the restoring tap ahead of anything the script sends */
+    if (probe.restore) {
+        probe.restore = !keyboard_probe_tap(&probe.tap);
+    }
+}
+
+/* Execution */
+
+void latency_tick(void) {
+    if (probe.restore) {
+        probe.restore = !keyboard_probe_tap(&probe.tap);
+        return;
+    }
+
+    if (probe.state != LATENCY_RUNNING) {
+        return;
+    }
+
+    if (!probe.waiting) {
+        probe.waiting = keyboard_probe_tap(&probe.tap);
+        return;
+    }
+
+    uint16_t rtt;
+    keyboard_probe_result_t result = keyboard_probe_poll(&probe.tap, &rtt);
+
+    if (result == KEYBOARD_PROBE_ECHOED) {
+        probe.waiting = false;
+        insert_sample(rtt);
+        if (probe.taken == probe.requested) {
+            end_run(LATENCY_DONE);
+        }
+    } else if (result == KEYBOARD_PROBE_TIMEOUT) {
+        /* The unechoed tap is taken as lost: restore from echoed taps */
+        end_run(LATENCY_TIMEOUT);
+    }
+}
+
+/* Results */
+
+void latency_get_result(latency_result_t *result) {
+    result->state = probe.state;
+    result->requested = probe.requested;
+    result->taken = probe.taken;
+
+    if (probe.taken == 0) {
+        result->min_ms = 0;
+        result->median_ms = 0;
+        result->max_ms = 0;
+        return;
+    }
+
+    result->min_ms = probe.samples[0];
+    result->median_ms = probe.samples[(probe.taken - 1) / 2];
+    result->max_ms = probe.samples[probe.taken - 1];
+}
@@ -0,0 +1,59 @@
+/**
+ * latency_probe.h - Host input round-trip latency probe
+ *
+ * Diagnostic run started through the programming protocol: taps Caps Lock
+ * and times how long the host takes to echo the LED change. Results are
+ * kept in RAM as a sorted sample set (min/median/max).
+ */
+
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* -------------------------------------------------------------------------- */
+/* Constants                                                                  */
+/* -------------------------------------------------------------------------- */
+
+#define LATENCY_MAX_SAMPLES 16
+
+/* -------------------------------------------------------------------------- */
+/* Types                                                                      */
+/* -------------------------------------------------------------------------- */
+
+typedef enum {
+    LATENCY_IDLE,      /* No run since boot */
+    LATENCY_RUNNING,   /* Taps in progress */
+    LATENCY_DONE,      /* All samples taken */
+    LATENCY_TIMEOUT    /* Host did not echo, run stopped */
+} latency_state_t;
+
+typedef struct {
+    latency_state_t state;
+    uint8_t requested;
+    uint8_t taken;
+    uint16_t min_ms;
+    uint16_t median_ms;
+    uint16_t max_ms;
+} latency_result_t;
+
+/* -------------------------------------------------------------------------- */
+/* Public API                                                                 */
+/* -------------------------------------------------------------------------- */
+
+/* Lifecycle */
+
+void latency_init(void);
+bool latency_start(uint8_t count);
+void latency_cancel(void);
+
+/* Execution */
+
+void latency_tick(void);
+
+/* Results */
+
+void latency_get_result(latency_result_t *result);
+
+#endif /* LATENCY_PROBE_H */
@@ -7,12 +7,14 @@
 #include "led.h"
 #include "timer.h"
 #include "eeprom_storage.h"
+#include "oscillator.h"
 #include "device_mode.h"
 
 int main(void) {
     led_init();
     timer_init();
     storage_init();
+    oscillator_init();
     device_mode_init();
 
     device_mode_run();  /* Never returns */
@@ -3,26 +3,85 @@
  *
  * Uses binary search followed by neighborhood search to find
  * the optimal OSCCAL value for stable USB timing at 16.5MHz.
+ *
+ * The last good value is cached in EEPROM. On USB reset it is checked
+ * with a single frame measurement and the full search only runs when the
+ * oscillator has drifted out of tolerance.
+ *
+ * oscillator_track() compares the Timer1 time of about 2 s of USB frames
+ * with the host's 1 ms frame clock and nudges OSCCAL by one step to follow
+ * thermal drift. It only reads counters, so it never disables interrupts
+ * and never touches the report queues.
  */
 
 #include "oscillator.h"
+#include "eeprom_storage.h"
+#include "usb_core.h"
+#include "timer.h"
+#include "config.h"
 
 #include <avr/io.h>
 #include "usbdrv.h"
 
 /* -------------------------------------------------------------------------- */
-/* Public                                                                     */
+/* Constants                                                                  */
 /* -------------------------------------------------------------------------- */
 
+#define OSCCAL_TARGET     ((int16_t)(1499 * (double)F_CPU / 10.5e6 + 0.5))
+#define OSCCAL_TOLERANCE  (OSCCAL_TARGET >> 7)   /* ~0.8%, about one OSCCAL step */
+#define OSCCAL_NONE       0xFF                   /* Erased EEPROM cell */
+#define OSCCAL_RANGE_TOP  0x7F                   /* Last value of the low range */
+
+#define TRACK_FRAMES      2048     /* Frames per drift measurement (~2 s) */
+#define TRACK_FRAME_US    1000UL   /* USB frame length, timed by the host */
+#define TRACK_GAP_US      255000UL /* Longer gaps may wrap V-USB's 8-bit frame count */
+#define TRACK_LATE_FRAMES 16       /* Windows closed later than this are discarded */
+#define TRACK_WINDOW_US   ((int32_t)(TRACK_FRAMES * TRACK_FRAME_US))
+#define TRACK_UNIT_STEPS  ((TRACK_WINDOW_US / 16 + OSCCAL_TARGET / 2) / OSCCAL_TARGET)
+
+/* -------------------------------------------------------------------------- */
+/* Private                                                                    */
+/* -------------------------------------------------------------------------- */
+
+/* State */
+
+static uint8_t cached_value;
+static bool cache_dirty;
+
+/* Drift tracking */
+
+static struct {
+    uint32_t start_frame;   /* First frame of the measurement window */
+    uint32_t start_us;      /* Timer1 time that frame was first seen */
+    uint32_t last_frame;    /* Frame seen by the previous call */
+    uint32_t last_us;       /* Timer1 time of the previous call */
+    bool started;           /* A window is open */
+    int16_t drift;
+    uint16_t adjustments;
+} track;
+
 /* Calibration */
 
-void calibrate_oscillator(void) {
+static bool validate_cached_value(void) {
+    if (cached_value == OSCCAL_NONE) {
+        return false;
+    }
+
+    OSCCAL = cached_value;
+    int16_t x = usbMeasureFrameLength() - OSCCAL_TARGET;
+    if (x < 0) {
+        x = -x;
+    }
+    return x <= OSCCAL_TOLERANCE;
+}
+
+static void search_oscillator(void) {
     uint8_t step = 128;
     uint8_t trial_value = 0;
     uint8_t optimum_value;
     int16_t x;
     int16_t optimum_dev;
-    int16_t target_value = (unsigned)(1499 * (double)F_CPU / 10.5e6 + 0.5);
+    int16_t target_value = OSCCAL_TARGET;
 
     /* Binary search for approximate value */
     do {
@@ -51,3 +110,130 @@ void calibrate_oscillator(void) {
 
     OSCCAL = optimum_value;
 }
+
+/* Drift tracking */
+
+static bool measure_drift(uint32_t frames, uint32_t elapsed_us, int16_t *drift) {
+    uint32_t late = frames - TRACK_FRAMES;
+    if (late >= TRACK_LATE_FRAMES) {
+        return false;
+    }
+
+    uint32_t expected_us = TRACK_WINDOW_US + (uint16_t)((uint16_t)late * (uint16_t)TRACK_FRAME_US);
+    int32_t error_us = (int32_t)(elapsed_us - expected_us);
+
+    /* Frames missing from the window: bus suspended, nothing to learn */
+    if (error_us >= TRACK_WINDOW_US / 8 || error_us <= -(TRACK_WINDOW_US / 8)) {
+        return false;
+    }
+
+    /*
+     * Same units as usbMeasureFrameLength() minus its target, scaled to a
+     * full window. In 16 us steps the error fits 16 bits, so this is a
+     * 16-bit divide; the late frames' share of the scale (<1%) is ignored.
+     */
+    *drift = (int16_t)(error_us >> 4) / (int16_t)TRACK_UNIT_STEPS;
+    return true;
+}
+
+static void nudge_oscillator(int16_t drift) {
+    uint8_t value = OSCCAL;
+
+    /* Never step across the boundary between the two OSCCAL ranges */
+    if (drift > OSCCAL_TOLERANCE && value != 0 && value != OSCCAL_RANGE_TOP + 1) {
+        OSCCAL = value - 1;
+    } else if (drift < -OSCCAL_TOLERANCE && value != 0xFF && value != OSCCAL_RANGE_TOP) {
+        OSCCAL = value + 1;
+    } else {
+        return;
+    }
+
+    track.adjustments++;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Public                                                                     */
+/* -------------------------------------------------------------------------- */
+
+/* Lifecycle */
+
+void oscillator_init(void) {
+    cached_value = storage_read_byte(STORAGE_OSCCAL_ADDRESS);
+    cache_dirty = false;
+
+    track.start_frame = 0;
+    track.start_us = 0;
+    track.last_frame = 0;
+    track.last_us = 0;
+    track.started = false;
+    track.drift = 0;
+    track.adjustments = 0;
+}
+
+/* Calibration */
+
+void calibrate_oscillator(void) {
+    /* Runs with interrupts disabled: no EEPROM access here */
+    if (validate_cached_value()) {
+        return;
+    }
+
+    search_oscillator();
+
+    if (OSCCAL != cached_value) {
+        cached_value = OSCCAL;
+        cache_dirty = true;
+    }
+}
+
+void oscillator_track(void) {
+    uint32_t frame = usb_frames();
+
+    /* Window edges are only taken when a new frame has just been counted */
+    if (frame == track.last_frame) {
+        return;
+    }
+    track.last_frame = frame;
+
+    uint32_t now = timer_micros();
+    uint32_t gap = now - track.last_us;
+    track.last_us = now;
+
+    /* After a long main-loop stall usb_frames() may have lost 256 frames */
+    if (track.started && gap < TRACK_GAP_US) {
+        uint32_t frames = frame - track.start_frame;
+        if (frames < TRACK_FRAMES) {
+            return;
+        }
+
+        int16_t drift;
+        if (measure_drift(frames, now - track.start_us, &drift)) {
+            track.drift = drift;
+            nudge_oscillator(drift);
+        }
+    }
+
+    track.start_frame = frame;
+    track.start_us = now;
+    track.started = true;
+}
+
+/* Persistence */
+
+void oscillator_persist(void) {
+    /* Wait for programming to finish rather than queue behind it */
+    if (cache_dirty && storage_is_idle()) {
+        cache_dirty = false;
+        storage_write_byte(STORAGE_OSCCAL_ADDRESS, cached_value);
+    }
+}
+
+/* Status */
+
+int16_t oscillator_get_drift(void) {
+    return track.drift;
+}
+
+uint16_t oscillator_get_adjustments(void) {
+    return track.adjustments;
+}
@@ -3,6 +3,7 @@
  *
  * Calibrates the internal RC oscillator to achieve stable USB timing.
  * Called automatically by V-USB via USB_RESET_HOOK during USB enumeration.
+ * The calibrated value is cached in EEPROM by oscillator_persist().
  */
 
 #ifndef OSCILLATOR_H
@@ -15,8 +16,22 @@
 /* Public API                                                                 */
 /* -------------------------------------------------------------------------- */
 
+/* Lifecycle */
+
+void oscillator_init(void);
+
 /* Calibration */
 
 void calibrate_oscillator(void);
+void oscillator_track(void);
+
+/* Persistence */
+
+void oscillator_persist(void);
+
+/* Status */
+
+int16_t oscillator_get_drift(void);
+uint16_t oscillator_get_adjustments(void);
 
 #endif /* OSCILLATOR_H */
@@ -1,5 +1,22 @@
 /**
  * script_engine.c - Bytecode interpreter for keyboard scripts
+ *
+ * Resumable state machine: each engine_tick() runs a bounded number of
+ * steps (one opcode or one STRING character) and never waits for USB.
+ *
+ * Delays end just ahead of the predicted EP1 poll nearest to their target,
+ * so the next report always leaves on the same poll.
+ *
+ * With HEADER_FLAG_ADAPTIVE_RATE, a STRING may first be preceded by a Caps
+ * Lock round-trip probe: the time until the host echoes the LED change sets
+ * the gap between typed characters.
+ *
+ * With HEADER_FLAG_COMPRESSED (and FEATURE_COMPRESSED builds), read_byte()
+ * decodes an LZ token stream on the fly. Matches copy bytes of an earlier
+ * literal run straight from EEPROM, so there is no history buffer; each
+ * match is checked against the stored runs before it is expanded.
+ * engine.ptr stays a position in the decoded bytecode and the token cursor
+ * is saved for REPEAT.
  */
 
 #include "script_engine.h"
@@ -7,31 +24,91 @@
 #include "config.h"
 #include "usb_core.h"
 #include "usb_keyboard.h"
+#include "usb_consumer.h"
 #include "keycode.h"
 #include "timer.h"
 
+/* -------------------------------------------------------------------------- */
+/* Constants                                                                  */
+/* -------------------------------------------------------------------------- */
+
+#define ENGINE_STEP_REPORTS  3     /* Max reports queued by a single step */
+#define ENGINE_STEP_CONSUMER 2     /* Consumer reports queued by one CONSUMER */
+#define ENGINE_TICK_STEPS    8     /* Max steps executed per engine_tick() */
+#define ENGINE_ALIGN_FRAMES  20    /* Delay left when the poll alignment is computed */
+#define ENGINE_LEAD_FRAMES   2     /* Frames to stage a report before the poll */
+
+#define ADAPT_INTERVAL_MS    10000 /* Minimum time between two probes */
+#define ADAPT_FAST_RTT_MS    30    /* Round-trip of a host that takes full speed */
+#define ADAPT_MAX_GAP_MS     100   /* Slowest pacing applied to a STRING */
+
 /* -------------------------------------------------------------------------- */
 /* Private                                                                    */
 /* -------------------------------------------------------------------------- */
 
+/* Types */
+
+typedef enum {
+    PROBE_NONE,      /* Not probing */
+    PROBE_TOGGLE,    /* Waiting for the first Caps Lock echo */
+    PROBE_RESTORE,   /* Waiting for the restoring Caps Lock echo */
+    PROBE_DISABLED   /* Host never echoed, adaptive rate off for this run */
+} probe_phase_t;
+
+#if FEATURE_COMPRESSED
+typedef struct {
+    uint16_t pos;       /* Next stored byte (token or literal) */
+    uint16_t src;       /* Next byte copied by the current match */
+    uint8_t literal;    /* Literal bytes left in the current run */
+    uint8_t match;      /* Bytes left in the current match */
+} lz_cursor_t;
+#endif
+
 /* State */
 
 static struct {
     uint16_t ptr;
     uint16_t length;
     engine_state_t state;
+    uint8_t flags;
+#if FEATURE_COMPRESSED
+    lz_cursor_t lz;
+#endif
 
     uint8_t modifiers;
-    uint8_t keys[KEYBOARD_MAX_KEYS];
+    uint8_t keys[KEYBOARD_NKRO_MAX_KEYS];
     uint8_t key_count;
 
-    uint16_t delay_start;
-    uint16_t delay_duration;
+    uint32_t delay_start;   /* Delays count USB frames (1 ms) */
+    uint32_t delay_duration;
+    uint32_t delay_release;
+    bool delay_aligned;
+
+    uint8_t wait_mask;      /* WAIT_LED in progress when non-zero */
+    uint8_t led_snapshot;   /* Host LEDs when the last report was queued */
 
     uint16_t repeat_start;
+#if FEATURE_COMPRESSED
+    lz_cursor_t repeat_lz;
+#endif
     uint8_t repeat_count;
     uint8_t repeat_length;
     bool in_repeat;
+
+    uint8_t string_remaining;
+    uint8_t string_op;       /* OP_STRING, OP_STRING_HID or OP_STRING_PACKED */
+#if FEATURE_STRING_PACKED
+    uint16_t string_bits;    /* STRING_PACKED bits read ahead */
+    uint8_t string_bit_count;
+#endif
+    uint8_t string_mods;
+    uint8_t string_key;
+    uint8_t string_gap;
+
+    probe_phase_t probe_phase;
+    keyboard_probe_t probe;
+    uint16_t probe_rtt;
+    uint32_t probe_last;
 } engine;
 
 /* Key management */
@@ -43,7 +120,7 @@ static bool add_key(uint8_t keycode) {
         }
     }
 
-    if (engine.key_count >= KEYBOARD_MAX_KEYS) {
+    if (engine.key_count >= keyboard_max_keys()) {
         return false;
     }
 
@@ -63,25 +140,115 @@ static void remove_key(uint8_t keycode) {
 static void clear_all_keys(void) {
     engine.modifiers = 0;
     engine.key_count = 0;
+    engine.string_key = 0;
 }
 
 /* Report sending */
 
 static void send_report(void) {
-    while (!keyboard_is_ready()) {
+    /* Host reactions to this report show up as LED changes from here */
+    engine.led_snapshot = keyboard_get_led_state();
+    while (!keyboard_send_report(engine.modifiers, engine.keys, engine.key_count)) {
         usb_poll();
     }
-    keyboard_send_report(engine.modifiers, engine.keys, engine.key_count);
 }
 
 /* Script reading */
 
+static uint8_t read_error(void) {
+    engine.state = ENGINE_ERROR;
+    return OP_END;
+}
+
+static uint8_t read_stored(uint16_t offset) {
+    return storage_read_byte(STORAGE_SCRIPT_START + offset);
+}
+
+#if FEATURE_COMPRESSED
+static bool lz_in_literal(uint16_t src, uint8_t length, uint16_t token_pos) {
+    uint16_t pos = 0;
+
+    /* Walk the tokens stored before the match to the run holding src */
+    while (pos < token_pos) {
+        uint8_t token = read_stored(pos++);
+        if (token & LZ_MATCH) {
+            pos++;
+            continue;
+        }
+
+        uint16_t run_end = pos + token + 1;
+        if (src < run_end) {
+            return src >= pos && src + length <= run_end && run_end <= token_pos;
+        }
+        pos = run_end;
+    }
+
+    return false;
+}
+
+static uint8_t read_compressed(void) {
+    lz_cursor_t *lz = &engine.lz;
+
+    if (lz->literal == 0 && lz->match == 0) {
+        uint16_t token_pos = lz->pos;
+        if (token_pos >= engine.length) {
+            return read_error();
+        }
+
+        uint8_t token = read_stored(lz->pos++);
+        if (token & LZ_MATCH) {
+            if (lz->pos >= engine.length) {
+                return read_error();
+            }
+            lz->match = ((token >> 1) & 0x3F) + LZ_MIN_MATCH;
+            lz->src = ((uint16_t)(token & 0x01) << 8) | read_stored(lz->pos++);
+
+            /* Only data bytes of one earlier literal run can be copied */
+            if (!lz_in_literal(lz->src, lz->match, token_pos)) {
+                return read_error();
+            }
+        } else {
+            lz->literal = token + 1;
+        }
+    }
+
+    engine.ptr++;
+    if (lz->match > 0) {
+        lz->match--;
+        return read_stored(lz->src++);
+    }
+
+    lz->literal--;
+    if (lz->pos >= engine.length) {
+        return read_error();
+    }
+    return read_stored(lz->pos++);
+}
+#endif
+
 static uint8_t read_byte(void) {
+#if FEATURE_COMPRESSED
+    if (engine.flags & HEADER_FLAG_COMPRESSED) {
+        return read_compressed();
+    }
+#endif
     if (engine.ptr >= engine.length) {
-        engine.state = ENGINE_ERROR;
-        return OP_END;
+        return read_error();
     }
-    return storage_read_byte(STORAGE_SCRIPT_START + engine.ptr++);
+    return read_stored(engine.ptr++);
+}
+
+static void skip_bytes(uint8_t count) {
+#if FEATURE_COMPRESSED
+    if (engine.flags & HEADER_FLAG_COMPRESSED) {
+        /* Token stream is only seekable forward by decoding */
+        while (count-- > 0 && engine.state != ENGINE_ERROR) {
+            read_compressed();
+        }
+        return;
+    }
+#endif
+    engine.ptr += count;
 }
 
 static uint16_t read_u16(void) {
@@ -100,7 +267,8 @@ static void op_end(void) {
 
 static void op_delay(void) {
     engine.delay_duration = read_u16();
-    engine.delay_start = timer_millis();
+    engine.delay_start = usb_frames();
+    engine.delay_aligned = false;
     engine.state = ENGINE_DELAYING;
 }
 
@@ -138,13 +306,16 @@ static void op_repeat(void) {
         uint8_t count = read_byte();
         uint8_t length = read_byte();
         (void)count;
-        engine.ptr += length;
+        skip_bytes(length);
         return;
     }
 
     engine.repeat_count = read_byte();
     engine.repeat_length = read_byte();
     engine.repeat_start = engine.ptr;
+#if FEATURE_COMPRESSED
+    engine.repeat_lz = engine.lz;
+#endif
     engine.in_repeat = true;
 }
 
@@ -163,33 +334,236 @@ static void op_combo(void) {
     send_report();
 }
 
-static void op_string(void) {
-    uint8_t length = read_byte();
+static void op_wait_led(void) {
+    engine.wait_mask = read_byte();
+    engine.delay_duration = read_u16();
+    engine.delay_start = usb_frames();
+    engine.delay_aligned = false;
+    engine.state = ENGINE_DELAYING;
+}
 
-    for (uint8_t i = 0; i < length; i++) {
-        char c = (char)read_byte();
+static void op_if_led(void) {
+    uint8_t mask = read_byte();
+    uint8_t value = read_byte();
+    uint8_t size = read_byte();
 
-        if (engine.state == ENGINE_ERROR) {
-            return;
-        }
+    if ((keyboard_get_led_state() & mask) != value) {
+        skip_bytes(size);
+    }
+}
 
-        keycode_result_t result = keycode_from_ascii(c);
+#if FEATURE_CONSUMER
+static void op_consumer(void) {
+    /* EP3 holds both reports until the keyboard reports before them are out */
+    consumer_send_report(read_u16());
+    consumer_send_report(0);
+}
+#endif
 
-        if (result.keycode == 0) {
-            continue;
+/* Adaptive rate probe */
+
+static void probe_begin(void) {
+    if (!(engine.flags & HEADER_FLAG_ADAPTIVE_RATE) || engine.probe_phase == PROBE_DISABLED) {
+        return;
+    }
+
+    /*
+     * Only hosts that already sent an LED report are known to echo one.
+     * The taps release everything, so nothing may be held either.
+     */
+    if (!keyboard_has_led_report() || engine.key_count != 0 || engine.modifiers != 0) {
+        return;
+    }
+    if (engine.probe_rtt != 0 && !timer_elapsed32(engine.probe_last, ADAPT_INTERVAL_MS)) {
+        return;
+    }
+
+    if (keyboard_probe_tap(&engine.probe)) {
+        engine.probe_rtt = 0;
+        engine.probe_phase = PROBE_TOGGLE;
+    }
+}
+
+static void probe_finish(void) {
+    engine.probe_phase = PROBE_NONE;
+    engine.probe_last = timer_millis32();
+
+    /* Hosts that echo within ADAPT_FAST_RTT_MS are typed at full speed */
+    uint16_t gap = 0;
+    if (engine.probe_rtt > ADAPT_FAST_RTT_MS) {
+        gap = (engine.probe_rtt - ADAPT_FAST_RTT_MS) / 2;
+    }
+    engine.string_gap = (gap > ADAPT_MAX_GAP_MS) ? ADAPT_MAX_GAP_MS : gap;
+}
+
+static void probe_poll(void) {
+    uint16_t rtt;
+    keyboard_probe_result_t result = keyboard_probe_poll(&engine.probe, &rtt);
+
+    if (result == KEYBOARD_PROBE_WAITING || keyboard_queue_space() < KEYBOARD_PROBE_REPORTS) {
+        return;
+    }
+
+    if (result == KEYBOARD_PROBE_TIMEOUT) {
+        /* No echo: undo the first tap anyway and stop probing this host */
+        if (engine.probe_phase == PROBE_TOGGLE) {
+            keyboard_probe_tap(&engine.probe);
+            engine.probe_phase = PROBE_DISABLED;
+            engine.string_gap = 0;
+        } else {
+            probe_finish();
         }
+        return;
+    }
+
+    /* Slowest of the two round-trips sets the pace */
+    if (rtt > engine.probe_rtt) {
+        engine.probe_rtt = rtt;
+    }
+
+    if (engine.probe_phase == PROBE_TOGGLE) {
+        engine.probe_phase = PROBE_RESTORE;
+        keyboard_probe_tap(&engine.probe);
+    } else {
+        probe_finish();
+    }
+}
+
+static void op_string(uint8_t opcode) {
+    engine.string_op = opcode;
+    engine.string_remaining = read_byte();
+#if FEATURE_STRING_PACKED
+    engine.string_bit_count = 0;
+#endif
+    engine.string_mods = engine.modifiers;
+    engine.string_key = 0;
+    probe_begin();
+}
+
+/* STRING typing (one character per step) */
 
-        if (result.modifiers != 0) {
-            uint8_t saved_mods = engine.modifiers;
-            engine.modifiers = result.modifiers;
-            op_tap(result.keycode);
-            engine.modifiers = saved_mods;
-            send_report();
+static void string_release(void) {
+    if (engine.string_key == 0 && engine.modifiers == engine.string_mods) {
+        return;
+    }
+
+    if (engine.string_key != 0) {
+        remove_key(engine.string_key);
+    }
+    engine.modifiers = engine.string_mods;
+    engine.string_key = 0;
+    send_report();
+}
+
+static void string_type_burst(keycode_result_t result) {
+    uint8_t mods = result.modifiers ? result.modifiers : engine.string_mods;
+
+    /* Repeated key or shift change needs a release in between */
+    if (engine.string_key == result.keycode || mods != engine.modifiers) {
+        string_release();
+    }
+
+    /* Release previous key and press next one in a single report */
+    if (engine.string_key != 0) {
+        remove_key(engine.string_key);
+    }
+    engine.modifiers = mods;
+    add_key(result.keycode);
+    engine.string_key = result.keycode;
+    send_report();
+}
+
+static void string_type_tap(keycode_result_t result) {
+    uint8_t mods = result.modifiers ? result.modifiers : engine.string_mods;
+
+    /* Shift stays held across a run of shifted characters */
+    if (mods != engine.modifiers) {
+        string_release();
+        engine.modifiers = mods;
+    }
+    op_tap(result.keycode);
+}
+
+#if FEATURE_STRING_PACKED
+static uint8_t string_read_bits(uint8_t count) {
+    while (engine.string_bit_count < count) {
+        engine.string_bits = (engine.string_bits << 8) | read_byte();
+        engine.string_bit_count += 8;
+    }
+
+    engine.string_bit_count -= count;
+    return (uint8_t)(engine.string_bits >> engine.string_bit_count) & (uint8_t)((1 << count) - 1);
+}
+
+static uint8_t string_read_packed(void) {
+    uint8_t code = string_read_bits(PACKED_CODE_BITS);
+
+    /* Space, a-z, A-Z, 0-9 by arithmetic, anything else escaped */
+    if (code == PACKED_ESCAPE) {
+        return string_read_bits(8);
+    }
+    if (code == 0) {
+        return ' ';
+    }
+    if (code <= 26) {
+        return (uint8_t)('a' + code - 1);
+    }
+    if (code <= 52) {
+        return (uint8_t)('A' + code - 27);
+    }
+    return (uint8_t)('0' + code - 53);
+}
+#endif
+
+static uint8_t string_read(void) {
+#if FEATURE_STRING_PACKED
+    if (engine.string_op == OP_STRING_PACKED) {
+        return string_read_packed();
+    }
+#endif
+    return read_byte();
+}
+
+static keycode_result_t string_resolve(uint8_t c) {
+#if FEATURE_STRING_HID
+    if (engine.string_op == OP_STRING_HID) {
+        /* Resolved by the host for its layout, no table lookup */
+        keycode_result_t result;
+        result.keycode = c & STRING_HID_USAGE;
+        result.modifiers = (c & STRING_HID_SHIFT) ? MOD_SHIFT : 0;
+        return result;
+    }
+#endif
+    return keycode_from_ascii((char)c);
+}
+
+static void string_step(void) {
+    uint8_t c = string_read();
+    engine.string_remaining--;
+
+    if (engine.state == ENGINE_ERROR) {
+        engine.string_remaining = 0;
+        return;
+    }
+
+    keycode_result_t result = string_resolve(c);
+
+    if (result.keycode != 0) {
+        if ((engine.flags & HEADER_FLAG_BURST_TYPING) && engine.string_gap == 0) {
+            string_type_burst(result);
         } else {
-            op_tap(result.keycode);
+            string_type_tap(result);
         }
+    }
 
-        usb_poll();
+    if (engine.string_remaining == 0) {
+        string_release();
+    } else if (engine.string_gap != 0) {
+        /* Adaptive pacing: the gap counts from delivery of the release */
+        engine.delay_duration = engine.string_gap;
+        engine.delay_start = usb_frames();
+        engine.delay_aligned = false;
+        engine.state = ENGINE_DELAYING;
     }
 }
 
@@ -203,19 +577,28 @@ static void execute_opcode(void) {
     }
 
     switch (opcode) {
-        case OP_END:      op_end();        break;
-        case OP_DELAY:    op_delay();      break;
-        case OP_KEY_DOWN: op_key_down();   break;
-        case OP_KEY_UP:   op_key_up();     break;
-        case OP_MOD:      op_mod();        break;
-        case OP_TAP:      op_tap_opcode(); break;
-        case OP_REPEAT:   op_repeat();     break;
-        case OP_COMBO:    op_combo();      break;
-        case OP_STRING:   op_string();     break;
+        case OP_END:           op_end();          break;
+        case OP_DELAY:         op_delay();        break;
+        case OP_KEY_DOWN:      op_key_down();     break;
+        case OP_KEY_UP:        op_key_up();       break;
+        case OP_MOD:           op_mod();          break;
+        case OP_TAP:           op_tap_opcode();   break;
+        case OP_REPEAT:        op_repeat();       break;
+        case OP_COMBO:         op_combo();        break;
+        case OP_STRING:        op_string(opcode); break;
+        case OP_WAIT_LED:      op_wait_led();     break;
+        case OP_IF_LED:        op_if_led();       break;
+#if FEATURE_CONSUMER
+        case OP_CONSUMER:      op_consumer();     break;
+#endif
+#if FEATURE_STRING_HID
+        case OP_STRING_HID:    op_string(opcode); break;
+#endif
+#if FEATURE_STRING_PACKED
+        case OP_STRING_PACKED: op_string(opcode); break;
+#endif
         default:
             engine.state = ENGINE_ERROR;
-            clear_all_keys();
-            send_report();
             break;
     }
 }
@@ -223,7 +606,7 @@ static void execute_opcode(void) {
 /* Check REPEAT block end */
 
 static void check_repeat(void) {
-    if (!engine.in_repeat) {
+    if (!engine.in_repeat || engine.string_remaining > 0) {
         return;
     }
 
@@ -231,12 +614,80 @@ static void check_repeat(void) {
         engine.repeat_count--;
         if (engine.repeat_count > 0) {
             engine.ptr = engine.repeat_start;
+#if FEATURE_COMPRESSED
+            engine.lz = engine.repeat_lz;
+#endif
         } else {
             engine.in_repeat = false;
         }
     }
 }
 
+/* Delay expiry */
+
+static bool delay_expired(void) {
+    uint32_t now = usb_frames();
+
+    if (!engine.delay_aligned) {
+        if (now - engine.delay_start + ENGINE_ALIGN_FRAMES < engine.delay_duration) {
+            return false;
+        }
+
+        /* Close to the end: release just ahead of the nearest EP1 poll */
+        uint32_t end = engine.delay_start + engine.delay_duration;
+        engine.delay_release = keyboard_align_to_poll(end) - ENGINE_LEAD_FRAMES;
+        engine.delay_aligned = true;
+    }
+
+    return (int32_t)(now - engine.delay_release) >= 0;
+}
+
+/* WAIT_LED completion */
+
+static bool wait_finished(void) {
+    if ((keyboard_get_led_state() ^ engine.led_snapshot) & engine.wait_mask) {
+        return true;
+    }
+
+    /* Timeout 0 waits for the LED change only */
+    return engine.delay_duration != 0 && keyboard_is_idle() && delay_expired();
+}
+
+/* Execute one step: a whole opcode or a single STRING character */
+
+static void execute_step(void) {
+    if (engine.string_remaining > 0) {
+        string_step();
+    } else {
+        execute_opcode();
+    }
+
+    if (engine.state == ENGINE_ERROR) {
+        clear_all_keys();
+        send_report();
+        return;
+    }
+
+    check_repeat();
+}
+
+static void run_steps(void) {
+    for (uint8_t i = 0; i < ENGINE_TICK_STEPS; i++) {
+        if (engine.state != ENGINE_RUNNING || engine.probe_phase == PROBE_TOGGLE ||
+            engine.probe_phase == PROBE_RESTORE || keyboard_queue_space() < ENGINE_STEP_REPORTS) {
+            return;
+        }
+
+#if FEATURE_CONSUMER
+        if (consumer_queue_space() < ENGINE_STEP_CONSUMER) {
+            return;
+        }
+#endif
+
+        execute_step();
+    }
+}
+
 /* -------------------------------------------------------------------------- */
 /* Public                                                                     */
 /* -------------------------------------------------------------------------- */
@@ -245,11 +696,18 @@ static void check_repeat(void) {
 
 void engine_init(void) {
     engine.state = ENGINE_IDLE;
+    engine.flags = 0;
     engine.ptr = 0;
     engine.length = 0;
     engine.modifiers = 0;
     engine.key_count = 0;
     engine.in_repeat = false;
+    engine.string_remaining = 0;
+    engine.string_key = 0;
+    engine.string_gap = 0;
+    engine.probe_phase = PROBE_NONE;
+    engine.probe_rtt = 0;
+    engine.wait_mask = 0;
 }
 
 void engine_start(void) {
@@ -258,24 +716,44 @@ void engine_start(void) {
         return;
     }
 
-    uint16_t initial_delay = storage_get_initial_delay();
-    if (initial_delay > 0) {
-        uint16_t start = timer_millis();
-        while (!timer_elapsed(start, initial_delay)) {
-            usb_poll();
-        }
-    }
-
     engine.ptr = 0;
+#if FEATURE_COMPRESSED
+    engine.lz.pos = 0;
+    engine.lz.literal = 0;
+    engine.lz.match = 0;
+#endif
     engine.length = storage_get_script_length();
-    engine.state = ENGINE_RUNNING;
+    engine.flags = storage_get_flags();
     engine.modifiers = 0;
     engine.key_count = 0;
     engine.in_repeat = false;
+    engine.string_remaining = 0;
+    engine.string_key = 0;
+    engine.string_gap = 0;
+    engine.probe_phase = PROBE_NONE;
+    engine.probe_rtt = 0;
+    engine.wait_mask = 0;
+    engine.led_snapshot = keyboard_get_led_state();
+
+#if !FEATURE_COMPRESSED
+    /* This build cannot decode the token stream: never type it raw */
+    if (engine.flags & HEADER_FLAG_COMPRESSED) {
+        engine.state = ENGINE_ERROR;
+        return;
+    }
+#endif
+
+    /* Initial delay runs as a regular DELAY so engine_tick() never blocks */
+    engine.delay_duration = storage_get_initial_delay();
+    engine.delay_start = usb_frames();
+    engine.delay_aligned = false;
+    engine.state = ENGINE_DELAYING;
 }
 
 void engine_stop(void) {
     clear_all_keys();
+    engine.string_remaining = 0;
+    engine.probe_phase = PROBE_NONE;
     send_report();
     engine.state = ENGINE_IDLE;
 }
@@ -290,12 +768,29 @@ engine_state_t engine_tick(void) {
             break;
 
         case ENGINE_RUNNING:
-            execute_opcode();
-            check_repeat();
+            if (engine.probe_phase == PROBE_TOGGLE || engine.probe_phase == PROBE_RESTORE) {
+                probe_poll();
+            }
+            run_steps();
             break;
 
         case ENGINE_DELAYING:
-            if (timer_elapsed(engine.delay_start, engine.delay_duration)) {
+            if (engine.wait_mask != 0) {
+                if (wait_finished()) {
+                    engine.wait_mask = 0;
+                    engine.state = ENGINE_RUNNING;
+                } else if (!keyboard_is_idle()) {
+                    engine.delay_start = usb_frames();
+                    engine.delay_aligned = false;
+                }
+                break;
+            }
+
+            /* Delay counts from delivery of the last queued report */
+            if (!keyboard_is_idle()) {
+                engine.delay_start = usb_frames();
+                engine.delay_aligned = false;
+            } else if (delay_expired()) {
                 engine.state = ENGINE_RUNNING;
             }
             break;
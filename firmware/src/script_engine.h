@@ -2,6 +2,7 @@
  * script_engine.h - Bytecode interpreter for keyboard scripts
  *
  * Executes scripts stored in EEPROM. Call engine_tick() frequently from main loop.
+ * Each call does a bounded amount of work and never waits for USB.
  */
 
 #ifndef SCRIPT_ENGINE_H
@@ -15,15 +16,32 @@
 /* -------------------------------------------------------------------------- */
 
 /* Opcodes */
-#define OP_END      0x00
-#define OP_DELAY    0x01
-#define OP_KEY_DOWN 0x02
-#define OP_KEY_UP   0x03
-#define OP_MOD      0x04
-#define OP_TAP      0x05
-#define OP_REPEAT   0x06
-#define OP_COMBO    0x07
-#define OP_STRING   0x08
+#define OP_END           0x00
+#define OP_DELAY         0x01
+#define OP_KEY_DOWN      0x02
+#define OP_KEY_UP        0x03
+#define OP_MOD           0x04
+#define OP_TAP           0x05
+#define OP_REPEAT        0x06
+#define OP_COMBO         0x07
+#define OP_STRING        0x08
+#define OP_WAIT_LED      0x09
+#define OP_IF_LED        0x0A
+#define OP_CONSUMER      0x0B
+#define OP_STRING_HID    0x0C
+#define OP_STRING_PACKED 0x0D
+
+/* STRING_HID payload byte: usage ID with the shift bit packed in */
+#define STRING_HID_SHIFT 0x80
+#define STRING_HID_USAGE 0x7F
+
+/* STRING_PACKED payload: 6-bit codes, MSB first */
+#define PACKED_CODE_BITS 6
+#define PACKED_ESCAPE    0x3F   /* Followed by one raw 8-bit ASCII character */
+
+/* Compressed bytecode tokens (HEADER_FLAG_COMPRESSED) */
+#define LZ_MATCH         0x80   /* 1LLLLLLO OOOOOOOO: copy L + 3 bytes from offset O */
+#define LZ_MIN_MATCH     3      /* 0NNNNNNN: N + 1 literal bytes follow */
 
 /* -------------------------------------------------------------------------- */
 /* Types                                                                      */
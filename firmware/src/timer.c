@@ -1,7 +1,9 @@
 /**
  * timer.c - Hardware timer for timing operations
  *
- * Timer1 configuration for ~1ms tick on ATtiny85 at 16.5MHz.
+ * Timer1 free-runs at F_CPU/256 and only interrupts on overflow (~4ms).
+ * The overflow ISR advances exact millisecond and microsecond accumulators;
+ * readers add the live counter value and never disable interrupts.
  */
 
 #include "timer.h"
@@ -14,12 +16,17 @@
 /* -------------------------------------------------------------------------- */
 
 /*
- * Timer1 in CTC mode with prescaler /128:
- * - Timer frequency: 16,500,000 / 128 = 128,906.25 Hz
- * - Ticks per ms: ~129
- * - Using OCR1C as TOP value
+ * Timer1 in normal mode with prescaler /256:
+ * - Timer frequency: 16,500,000 / 256 = 64,453.125 Hz
+ * - One tick: 512/33 us = 15 + 17/33 us (~15.5 us)
+ * - One overflow (256 ticks): 3971 + 29/33 us (~3.97 ms)
  */
-#define TIMER1_TOP 128
+#define TIMER1_PRESCALER   ((1 << CS13) | (1 << CS10))
+#define TICK_US            15   /* Whole us per tick */
+#define TICK_US_FRAC       17   /* In 1/33 us */
+#define TICK_US_DEN        33
+#define OVERFLOW_US        3971
+#define OVERFLOW_US_FRAC   29   /* In 1/33 us */
 
 /* -------------------------------------------------------------------------- */
 /* Private                                                                    */
@@ -27,12 +34,62 @@
 
 /* State */
 
-static volatile uint16_t millis_counter;
+static volatile struct {
+    uint8_t seq;            /* Bumped by every overflow */
+    uint8_t frac;           /* 1/33 us remainder */
+    uint16_t ms_remainder;  /* us past the last whole millisecond */
+    uint32_t millis;
+    uint32_t micros;
+} clock;
+
+typedef struct {
+    uint32_t millis;
+    uint32_t micros;
+    uint16_t ms_remainder;
+    uint8_t ticks;
+} snapshot_t;
 
 /* ISR */
 
-ISR(TIMER1_COMPA_vect) {
-    millis_counter++;
+ISR(TIMER1_OVF_vect, ISR_NOBLOCK) {
+    uint16_t us = OVERFLOW_US;
+
+    clock.frac += OVERFLOW_US_FRAC;
+    if (clock.frac >= TICK_US_DEN) {
+        clock.frac -= TICK_US_DEN;
+        us++;
+    }
+
+    clock.micros += us;
+
+    us += clock.ms_remainder;
+    while (us >= 1000) {
+        us -= 1000;
+        clock.millis++;
+    }
+    clock.ms_remainder = us;
+
+    clock.seq++;
+}
+
+/* Helpers */
+
+static void read_clock(snapshot_t *snap) {
+    uint8_t seq;
+
+    /* Retry if an overflow was handled while reading */
+    do {
+        seq = clock.seq;
+        snap->millis = clock.millis;
+        snap->micros = clock.micros;
+        snap->ms_remainder = clock.ms_remainder;
+        snap->ticks = TCNT1;
+    } while (seq != clock.seq);
+}
+
+static uint16_t ticks_to_micros(uint8_t ticks) {
+    /* ticks * 512/33 split so every step fits 16 bits (no 32-bit divide) */
+    return (uint16_t)(ticks * TICK_US) + (uint16_t)(ticks * TICK_US_FRAC) / TICK_US_DEN;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -42,33 +99,45 @@ ISR(TIMER1_COMPA_vect) {
 /* Lifecycle */
 
 void timer_init(void) {
-    /*
-     * Timer1 in CTC mode:
-     * - CTC1: Clear timer on compare match with OCR1C
-     * - CS13: Prescaler /128 (ATtiny85 specific)
-     */
-    TCCR1 = (1 << CTC1) | (1 << CS13);
-
-    OCR1C = TIMER1_TOP;
-    OCR1A = TIMER1_TOP;
-
-    TIMSK |= (1 << OCIE1A);
-
-    millis_counter = 0;
+    /* Normal mode: count 0-255 and raise TOV1 on wrap */
+    TCCR1 = TIMER1_PRESCALER;
+    TCNT1 = 0;
+
+    TIFR = (1 << TOV1);
+    TIMSK |= (1 << TOIE1);
+
+    clock.seq = 0;
+    clock.frac = 0;
+    clock.ms_remainder = 0;
+    clock.millis = 0;
+    clock.micros = 0;
 }
 
 /* Time Queries */
 
-uint16_t timer_millis(void) {
-    uint16_t ms;
+uint32_t timer_micros(void) {
+    snapshot_t snap;
+    read_clock(&snap);
+    return snap.micros + ticks_to_micros(snap.ticks);
+}
 
-    cli();
-    ms = millis_counter;
-    sei();
+uint32_t timer_millis32(void) {
+    snapshot_t snap;
+    read_clock(&snap);
 
-    return ms;
+    /* Below 5,000 us: a 16-bit divide */
+    uint16_t us = snap.ms_remainder + ticks_to_micros(snap.ticks);
+    return snap.millis + us / 1000;
+}
+
+uint16_t timer_millis(void) {
+    return (uint16_t)timer_millis32();
 }
 
 bool timer_elapsed(uint16_t start, uint16_t duration) {
-    return (timer_millis() - start) >= duration;
+    return (uint16_t)(timer_millis() - start) >= duration;
+}
+
+bool timer_elapsed32(uint32_t start, uint32_t duration) {
+    return (timer_millis32() - start) >= duration;
 }
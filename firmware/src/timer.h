@@ -1,7 +1,9 @@
 /**
  * timer.h - Hardware timer for timing operations
  *
- * Uses Timer1 on ATtiny85 to provide millisecond-resolution timing.
+ * Uses Timer1 on ATtiny85 as a free-running timebase with ~15.5us resolution.
+ * Reads are lock-free and safe with interrupts enabled; 32-bit millisecond
+ * time wraps after ~49 days.
  * Non-blocking: caller is responsible for calling usbPoll() or keyboard_poll().
  */
 
@@ -21,7 +23,10 @@ void timer_init(void);
 
 /* Time Queries */
 
+uint32_t timer_micros(void);
+uint32_t timer_millis32(void);
 uint16_t timer_millis(void);
 bool timer_elapsed(uint16_t start, uint16_t duration);
+bool timer_elapsed32(uint32_t start, uint32_t duration);
 
 #endif /* TIMER_H */
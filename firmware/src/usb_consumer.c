@@ -0,0 +1,84 @@
+/**
+ * usb_consumer.c - USB HID consumer control reports
+ *
+ * Consumer control is a second top-level collection (report ID 3) on the
+ * raw HID interface, so its reports use EP3, which the programming
+ * protocol leaves idle. EP1 and EP3 are polled independently, so consumer
+ * and keyboard reports interleave.
+ *
+ * A report holds one usage, 0 meaning released. Reports are queued with
+ * the serial of the last keyboard report queued before them and handed to
+ * V-USB by consumer_flush() (called from usb_poll()) once that keyboard
+ * report has left EP1. Later keyboard reports are not waited for.
+ */
+
+#include "usb_consumer.h"
+#include "config.h"
+#include "usb_keyboard.h"
+#include "usbdrv.h"
+
+/* -------------------------------------------------------------------------- */
+/* Private                                                                    */
+/* -------------------------------------------------------------------------- */
+
+/* State */
+
+static uint8_t report_buffer[CONSUMER_REPORT_SIZE];
+static struct {
+    uint16_t usage;
+    uint8_t after;   /* Keyboard report that must leave first */
+} queue[CONSUMER_QUEUE_SIZE];
+static uint8_t queue_head;
+static uint8_t queue_count;
+
+/* -------------------------------------------------------------------------- */
+/* Public                                                                     */
+/* -------------------------------------------------------------------------- */
+
+/* Lifecycle */
+
+void consumer_init(void) {
+    queue_head = 0;
+    queue_count = 0;
+}
+
+/* USB Maintenance */
+
+void consumer_flush(void) {
+    if (queue_count == 0 || !usbInterruptIsReady3()) {
+        return;
+    }
+
+    if (!keyboard_has_delivered(queue[queue_head].after)) {
+        return;
+    }
+
+    uint16_t usage = queue[queue_head].usage;
+    report_buffer[0] = PROTOCOL_REPORT_ID_CONSUMER;
+    report_buffer[1] = (uint8_t)usage;
+    report_buffer[2] = (uint8_t)(usage >> 8);
+    usbSetInterrupt3((uchar *)report_buffer, sizeof(report_buffer));
+
+    queue_head = (queue_head + 1) % CONSUMER_QUEUE_SIZE;
+    queue_count--;
+}
+
+uint8_t consumer_queue_space(void) {
+    return CONSUMER_QUEUE_SIZE - queue_count;
+}
+
+/* Report Sending */
+
+bool consumer_send_report(uint16_t usage) {
+    if (queue_count >= CONSUMER_QUEUE_SIZE) {
+        return false;
+    }
+
+    uint8_t slot = (queue_head + queue_count) % CONSUMER_QUEUE_SIZE;
+    queue[slot].usage = usage;
+    queue[slot].after = keyboard_last_report();
+    queue_count++;
+
+    consumer_flush();
+    return true;
+}
@@ -0,0 +1,39 @@
+/**
+ * usb_consumer.h - USB HID consumer control reports
+ *
+ * Sends consumer control usages (media keys, volume, ...) on the raw HID
+ * interface's EP3, alongside the keyboard reports on EP1. Each report
+ * leaves only after the keyboard reports queued before it.
+ */
+
+#ifndef USB_CONSUMER_H
+#define USB_CONSUMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* -------------------------------------------------------------------------- */
+/* Constants                                                                  */
+/* -------------------------------------------------------------------------- */
+
+#define CONSUMER_REPORT_SIZE 3   /* Report ID + 16-bit usage */
+#define CONSUMER_QUEUE_SIZE  4   /* Pending reports awaiting EP3 */
+
+/* -------------------------------------------------------------------------- */
+/* Public API                                                                 */
+/* -------------------------------------------------------------------------- */
+
+/* Lifecycle */
+
+void consumer_init(void);
+
+/* USB Maintenance */
+
+void consumer_flush(void);
+uint8_t consumer_queue_space(void);
+
+/* Report Sending */
+
+bool consumer_send_report(uint16_t usage);
+
+#endif /* USB_CONSUMER_H */
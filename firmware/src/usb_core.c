@@ -2,10 +2,21 @@
  * usb_core.c - USB interface for application layer
  *
  * Encapsulates V-USB initialization and polling. Application modules
- * use this instead of calling V-USB directly.
+ * use this instead of calling V-USB directly. Polling also drains the
+ * keyboard and consumer report queues into their interrupt endpoints.
+ *
+ * V-USB counts frames (SOF keep-alives) in an 8-bit counter from the USB
+ * interrupt. It is extended to 32 bits here on every poll, giving a 1 ms
+ * timebase locked to the host clock. Frames stop during a bus reset or
+ * suspend; when they resume, the keyboard resends its current report from
+ * the first packet.
  */
 
 #include "usb_core.h"
+#include "config.h"
+#include "usb_keyboard.h"
+#include "usb_consumer.h"
+#include "timer.h"
 #include "usbdrv.h"
 
 #include <avr/io.h>
@@ -16,7 +27,45 @@
 /* Constants                                                                  */
 /* -------------------------------------------------------------------------- */
 
-#define USB_DISCONNECT_MS 300
+#define USB_DISCONNECT_MS      300
+#define USB_DISCONNECT_FAST_MS 20   /* Still well above host disconnect detection */
+#define USB_IDLE_MS            3    /* No frames this long: reset or suspend */
+
+/* -------------------------------------------------------------------------- */
+/* Private                                                                    */
+/* -------------------------------------------------------------------------- */
+
+/* State */
+
+static uint32_t frame_count;
+static uint8_t last_sof;
+static uint32_t active_frame;   /* frame_count when frames were last seen */
+static uint16_t active_ms;      /* timer_millis() at that point */
+static bool bus_idle;           /* Frames stopped for USB_IDLE_MS */
+
+/* Helpers */
+
+static void update_frames(void) {
+    /* Single byte, written by the USB interrupt: read is atomic */
+    uint8_t sof = usbSofCount;
+    frame_count += (uint8_t)(sof - last_sof);
+    last_sof = sof;
+}
+
+static void track_bus(void) {
+    uint16_t now = timer_millis();
+
+    if (frame_count != active_frame) {
+        active_frame = frame_count;
+        active_ms = now;
+        if (bus_idle) {
+            bus_idle = false;
+            keyboard_resync();
+        }
+    } else if ((uint16_t)(now - active_ms) >= USB_IDLE_MS) {
+        bus_idle = true;
+    }
+}
 
 /* -------------------------------------------------------------------------- */
 /* Public                                                                     */
@@ -24,13 +73,22 @@
 
 /* Lifecycle */
 
-void usb_init(void) {
+void usb_init(bool fast) {
     cli();
     PORTB &= ~(_BV(USB_CFG_DMINUS_BIT) | _BV(USB_CFG_DPLUS_BIT));
     usbDeviceDisconnect();
-    _delay_ms(USB_DISCONNECT_MS);
+    if (fast) {
+        _delay_ms(USB_DISCONNECT_FAST_MS);
+    } else {
+        _delay_ms(USB_DISCONNECT_MS);
+    }
     usbDeviceConnect();
     usbInit();
+    frame_count = 0;
+    last_sof = usbSofCount;
+    active_frame = 0;
+    active_ms = timer_millis();
+    bus_idle = false;
     sei();
 }
 
@@ -38,4 +96,17 @@ void usb_init(void) {
 
 void usb_poll(void) {
     usbPoll();
+    update_frames();
+    track_bus();
+    keyboard_flush();
+#if FEATURE_CONSUMER
+    consumer_flush();
+#endif
+}
+
+/* Frame Timebase */
+
+uint32_t usb_frames(void) {
+    update_frames();
+    return frame_count;
 }
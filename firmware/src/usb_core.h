@@ -8,16 +8,23 @@
 #ifndef USB_CORE_H
 #define USB_CORE_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 /* -------------------------------------------------------------------------- */
 /* Public API                                                                 */
 /* -------------------------------------------------------------------------- */
 
 /* Lifecycle */
 
-void usb_init(void);
+void usb_init(bool fast);
 
 /* Maintenance */
 
 void usb_poll(void);
 
+/* Frame Timebase */
+
+uint32_t usb_frames(void);
+
 #endif /* USB_CORE_H */
@@ -1,49 +1,61 @@
 /**
  * usb_descriptors.c - Dynamic USB descriptors
  *
- * Provides USB descriptors based on current device mode.
- * Programming mode: Raw HID (Usage Page 0xFF00, no subclass/protocol)
- * Keyboard mode: Boot Protocol HID (Usage Page 0x01, boot keyboard)
+ * Provides the composite configuration and per-interface HID descriptors.
+ * Interface 0: Boot Protocol HID (Usage Page 0x01, boot keyboard, EP1),
+ *              with a bitmap report descriptor when NKRO is enabled
+ * Interface 1: Raw HID (Usage Page 0xFF00, no subclass/protocol), plus
+ *              Consumer Control (Usage Page 0x0C, input on EP3) in builds
+ *              with FEATURE_CONSUMER
  */
 
 #include "usb_descriptors.h"
-#include "device_mode.h"
 #include "config.h"
+#include "usb_keyboard.h"
 #include <avr/pgmspace.h>
 
 /* -------------------------------------------------------------------------- */
 /* Constants                                                                  */
 /* -------------------------------------------------------------------------- */
 
-/* Configuration descriptor total lengths */
-#define CONFIG_TOTAL_LENGTH_KEYBOARD   34   /* 9 + 9 + 9 + 7 */
-#define CONFIG_TOTAL_LENGTH_RAWHID     34   /* Same structure */
+/* Configuration descriptor total length */
+#define CONFIG_TOTAL_LENGTH            59   /* 9 + 2 * (9 + 9 + 7) */
+
+/* Offsets of the HID descriptors within the configuration descriptor */
+#define HID_DESCRIPTOR_OFFSET_KEYBOARD 18
+#define HID_DESCRIPTOR_OFFSET_RAWHID   43
 
 /* HID report descriptor lengths */
 #define HID_REPORT_LENGTH_KEYBOARD     63
-#define HID_REPORT_LENGTH_RAWHID       29
+#if FEATURE_CONSUMER
+#define HID_REPORT_LENGTH_RAWHID       65   /* With the consumer collection */
+#else
+#define HID_REPORT_LENGTH_RAWHID       40
+#endif
 
 /* -------------------------------------------------------------------------- */
 /* Private                                                                    */
 /* -------------------------------------------------------------------------- */
 
-/* Configuration Descriptor - Keyboard Mode (Boot Protocol HID) */
+/* Configuration Descriptor - Composite (Boot Keyboard + Raw HID) */
 
-static const PROGMEM char config_descriptor_keyboard[] = {
+static const PROGMEM char config_descriptor[] = {
     /* Configuration Descriptor (9 bytes) */
     9,                                      /* bLength            */
     DESCRIPTOR_TYPE_CONFIGURATION,          /* bDescriptorType    */
-    CONFIG_TOTAL_LENGTH_KEYBOARD, 0,        /* wTotalLength (LE)  */
-    1,                                      /* bNumInterfaces     */
+    CONFIG_TOTAL_LENGTH, 0,                 /* wTotalLength (LE)  */
+    2,                                      /* bNumInterfaces     */
     1,                                      /* bConfigurationValue*/
     0,                                      /* iConfiguration     */
     0x80,                                   /* bmAttributes (bus) */
     50,                                     /* bMaxPower (100mA)  */
 
+    /* Interface 0: Boot Keyboard */
+
     /* Interface Descriptor (9 bytes) */
     9,                                      /* bLength            */
     DESCRIPTOR_TYPE_INTERFACE,              /* bDescriptorType    */
-    0,                                      /* bInterfaceNumber   */
+    USB_INTERFACE_KEYBOARD,                 /* bInterfaceNumber   */
     0,                                      /* bAlternateSetting  */
     1,                                      /* bNumEndpoints      */
     0x03,                                   /* bInterfaceClass (HID) */
@@ -66,29 +78,14 @@ static const PROGMEM char config_descriptor_keyboard[] = {
     0x81,                                   /* bEndpointAddress (IN 1) */
     0x03,                                   /* bmAttributes (Interrupt) */
     8, 0,                                   /* wMaxPacketSize (LE)*/
-    10                                      /* bInterval (10ms)   */
-};
-
-_Static_assert(sizeof(config_descriptor_keyboard) == CONFIG_TOTAL_LENGTH_KEYBOARD,
-               "Configuration descriptor length mismatch");
+    10,                                     /* bInterval (10ms)   */
 
-/* Configuration Descriptor - Programming Mode (Raw HID) */
-
-static const PROGMEM char config_descriptor_rawhid[] = {
-    /* Configuration Descriptor (9 bytes) */
-    9,                                      /* bLength            */
-    DESCRIPTOR_TYPE_CONFIGURATION,          /* bDescriptorType    */
-    CONFIG_TOTAL_LENGTH_RAWHID, 0,          /* wTotalLength (LE)  */
-    1,                                      /* bNumInterfaces     */
-    1,                                      /* bConfigurationValue*/
-    0,                                      /* iConfiguration     */
-    0x80,                                   /* bmAttributes (bus) */
-    50,                                     /* bMaxPower (100mA)  */
+    /* Interface 1: Raw HID (Programming) */
 
     /* Interface Descriptor (9 bytes) */
     9,                                      /* bLength            */
     DESCRIPTOR_TYPE_INTERFACE,              /* bDescriptorType    */
-    0,                                      /* bInterfaceNumber   */
+    USB_INTERFACE_RAWHID,                   /* bInterfaceNumber   */
     0,                                      /* bAlternateSetting  */
     1,                                      /* bNumEndpoints      */
     0x03,                                   /* bInterfaceClass (HID) */
@@ -108,16 +105,16 @@ static const PROGMEM char config_descriptor_rawhid[] = {
     /* Endpoint Descriptor (7 bytes) */
     7,                                      /* bLength            */
     DESCRIPTOR_TYPE_ENDPOINT,               /* bDescriptorType    */
-    0x81,                                   /* bEndpointAddress (IN 1) */
+    0x80 | USB_CFG_EP3_NUMBER,              /* bEndpointAddress (IN 3) */
     0x03,                                   /* bmAttributes (Interrupt) */
     8, 0,                                   /* wMaxPacketSize (LE)*/
     10                                      /* bInterval (10ms)   */
 };
 
-_Static_assert(sizeof(config_descriptor_rawhid) == CONFIG_TOTAL_LENGTH_RAWHID,
+_Static_assert(sizeof(config_descriptor) == CONFIG_TOTAL_LENGTH,
                "Configuration descriptor length mismatch");
 
-/* HID Report Descriptor - Keyboard Mode (Boot Protocol, 63 bytes) */
+/* HID Report Descriptor - Interface 0 (Boot Protocol, 63 bytes) */
 
 static const PROGMEM char hid_report_keyboard[] = {
     0x05, 0x01,         /* USAGE_PAGE (Generic Desktop)              */
@@ -166,7 +163,68 @@ static const PROGMEM char hid_report_keyboard[] = {
 _Static_assert(sizeof(hid_report_keyboard) == HID_REPORT_LENGTH_KEYBOARD,
                "HID report descriptor length mismatch");
 
-/* HID Report Descriptor - Programming Mode (Raw HID, 29 bytes) */
+/*
+ * HID Report Descriptor - Interface 0 (NKRO, 63 bytes)
+ *
+ * Same header as the boot descriptor, with the key array replaced by a
+ * bitmap of usages 0x00-0x6F. Kept at the same length so the HID
+ * descriptor in the configuration does not depend on the mode.
+ */
+
+static const PROGMEM char hid_report_keyboard_nkro[] = {
+    0x05, 0x01,         /* USAGE_PAGE (Generic Desktop)              */
+    0x09, 0x06,         /* USAGE (Keyboard)                          */
+    0xA1, 0x01,         /* COLLECTION (Application)                  */
+
+    /* Modifier byte (8 bits) */
+    0x05, 0x07,         /*   USAGE_PAGE (Keyboard/Key Codes)         */
+    0x19, 0xE0,         /*   USAGE_MINIMUM (224) - Left Ctrl         */
+    0x29, 0xE7,         /*   USAGE_MAXIMUM (231) - Right GUI         */
+    0x15, 0x00,         /*   LOGICAL_MINIMUM (0)                     */
+    0x25, 0x01,         /*   LOGICAL_MAXIMUM (1)                     */
+    0x75, 0x01,         /*   REPORT_SIZE (1)                         */
+    0x95, 0x08,         /*   REPORT_COUNT (8)                        */
+    0x81, 0x02,         /*   INPUT (Data,Var,Abs) - Modifier byte    */
+
+    /* Reserved byte */
+    0x95, 0x01,         /*   REPORT_COUNT (1)                        */
+    0x75, 0x08,         /*   REPORT_SIZE (8)                         */
+    0x81, 0x03,         /*   INPUT (Cnst,Var,Abs) - Reserved byte    */
+
+    /* LED output report (5 bits + 3 padding) */
+    0x95, 0x05,         /*   REPORT_COUNT (5)                        */
+    0x75, 0x01,         /*   REPORT_SIZE (1)                         */
+    0x05, 0x08,         /*   USAGE_PAGE (LEDs)                       */
+    0x19, 0x01,         /*   USAGE_MINIMUM (Num Lock)                */
+    0x29, 0x05,         /*   USAGE_MAXIMUM (Kana)                    */
+    0x91, 0x02,         /*   OUTPUT (Data,Var,Abs) - LED report      */
+    0x95, 0x01,         /*   REPORT_COUNT (1)                        */
+    0x75, 0x03,         /*   REPORT_SIZE (3)                         */
+    0x91, 0x03,         /*   OUTPUT (Cnst,Var,Abs) - LED padding     */
+
+    /* Key bitmap (112 bits) */
+    0x95, 0x70,         /*   REPORT_COUNT (112)                      */
+    0x75, 0x01,         /*   REPORT_SIZE (1)                         */
+    0x15, 0x00,         /*   LOGICAL_MINIMUM (0)                     */
+    0x25, 0x01,         /*   LOGICAL_MAXIMUM (1)                     */
+    0x05, 0x07,         /*   USAGE_PAGE (Keyboard/Key Codes)         */
+    0x19, 0x00,         /*   USAGE_MINIMUM (0)                       */
+    0x29, 0x6F,         /*   USAGE_MAXIMUM (111)                     */
+    0x81, 0x02,         /*   INPUT (Data,Var,Abs) - Key bitmap       */
+
+    0xC0                /* END_COLLECTION                            */
+};
+
+_Static_assert(sizeof(hid_report_keyboard_nkro) == HID_REPORT_LENGTH_KEYBOARD,
+               "HID report descriptor length mismatch");
+
+/*
+ * HID Report Descriptor - Interface 1 (Raw HID + Consumer Control, 65 bytes,
+ * or 40 bytes of Raw HID alone without FEATURE_CONSUMER)
+ *
+ * The consumer collection is input-only, so hosts never send it a
+ * SET_REPORT that would be taken for programming activity.
+ */
 
 static const PROGMEM char hid_report_rawhid[] = {
     0x06, 0x00, 0xFF,   /* USAGE_PAGE (Vendor Defined 0xFF00)        */
@@ -176,6 +234,9 @@ static const PROGMEM char hid_report_rawhid[] = {
     0x15, 0x00,         /*   LOGICAL_MINIMUM (0)                     */
     0x26, 0xFF, 0x00,   /*   LOGICAL_MAXIMUM (255)                   */
     0x75, 0x08,         /*   REPORT_SIZE (8)                         */
+
+    /* Command report (32 bytes) */
+    0x85, PROTOCOL_REPORT_ID_COMMAND, /*   REPORT_ID (1)             */
     0x95, PROTOCOL_REPORT_SIZE, /*   REPORT_COUNT (32)               */
     0x09, 0x01,         /*   USAGE (Vendor Usage 1)                  */
     0x81, 0x02,         /*   INPUT (Data,Var,Abs)                    */
@@ -184,7 +245,32 @@ static const PROGMEM char hid_report_rawhid[] = {
     0x09, 0x01,         /*   USAGE (Vendor Usage 1)                  */
     0xB1, 0x02,         /*   FEATURE (Data,Var,Abs)                  */
 
-    0xC0                /* END_COLLECTION                            */
+    /* Bulk report (length + whole script area, 505 bytes) */
+    0x85, PROTOCOL_REPORT_ID_BULK, /*   REPORT_ID (2)                */
+    0x96, PROTOCOL_BULK_REPORT_SIZE & 0xFF,
+          PROTOCOL_BULK_REPORT_SIZE >> 8, /*   REPORT_COUNT (505)    */
+    0x09, 0x02,         /*   USAGE (Vendor Usage 2)                  */
+    0xB1, 0x02,         /*   FEATURE (Data,Var,Abs)                  */
+
+    0xC0,               /* END_COLLECTION                            */
+#if FEATURE_CONSUMER
+
+    0x05, 0x0C,         /* USAGE_PAGE (Consumer)                     */
+    0x09, 0x01,         /* USAGE (Consumer Control)                  */
+    0xA1, 0x01,         /* COLLECTION (Application)                  */
+
+    /* Consumer report (one 16-bit usage, EP3) */
+    0x85, PROTOCOL_REPORT_ID_CONSUMER, /*   REPORT_ID (3)            */
+    0x15, 0x00,         /*   LOGICAL_MINIMUM (0)                     */
+    0x26, 0xFF, 0x03,   /*   LOGICAL_MAXIMUM (1023)                  */
+    0x19, 0x00,         /*   USAGE_MINIMUM (0)                       */
+    0x2A, 0xFF, 0x03,   /*   USAGE_MAXIMUM (1023)                    */
+    0x75, 0x10,         /*   REPORT_SIZE (16)                        */
+    0x95, 0x01,         /*   REPORT_COUNT (1)                        */
+    0x81, 0x00,         /*   INPUT (Data,Ary,Abs)                    */
+
+    0xC0,               /* END_COLLECTION                            */
+#endif
 };
 
 _Static_assert(sizeof(hid_report_rawhid) == HID_REPORT_LENGTH_RAWHID,
@@ -195,32 +281,32 @@ _Static_assert(sizeof(hid_report_rawhid) == HID_REPORT_LENGTH_RAWHID,
 /* -------------------------------------------------------------------------- */
 
 usbMsgLen_t descriptors_get_configuration(void) {
-    if (device_mode_is_keyboard()) {
-        usbMsgPtr = (usbMsgPtr_t)config_descriptor_keyboard;
-        return sizeof(config_descriptor_keyboard);
-    }
-
-    usbMsgPtr = (usbMsgPtr_t)config_descriptor_rawhid;
-    return sizeof(config_descriptor_rawhid);
+    usbMsgPtr = (usbMsgPtr_t)config_descriptor;
+    return sizeof(config_descriptor);
 }
 
-usbMsgLen_t descriptors_get_hid(void) {
-    /* HID descriptor is embedded in configuration descriptor at offset 18 */
-    if (device_mode_is_keyboard()) {
-        usbMsgPtr = (usbMsgPtr_t)(config_descriptor_keyboard + 18);
+usbMsgLen_t descriptors_get_hid(uint8_t interface) {
+    /* HID descriptors are embedded in the configuration descriptor */
+    if (interface == USB_INTERFACE_RAWHID) {
+        usbMsgPtr = (usbMsgPtr_t)(config_descriptor + HID_DESCRIPTOR_OFFSET_RAWHID);
         return 9;
     }
 
-    usbMsgPtr = (usbMsgPtr_t)(config_descriptor_rawhid + 18);
+    usbMsgPtr = (usbMsgPtr_t)(config_descriptor + HID_DESCRIPTOR_OFFSET_KEYBOARD);
     return 9;
 }
 
-usbMsgLen_t descriptors_get_hid_report(void) {
-    if (device_mode_is_keyboard()) {
-        usbMsgPtr = (usbMsgPtr_t)hid_report_keyboard;
-        return sizeof(hid_report_keyboard);
+usbMsgLen_t descriptors_get_hid_report(uint8_t interface) {
+    if (interface == USB_INTERFACE_RAWHID) {
+        usbMsgPtr = (usbMsgPtr_t)hid_report_rawhid;
+        return sizeof(hid_report_rawhid);
+    }
+
+    if (keyboard_is_nkro()) {
+        usbMsgPtr = (usbMsgPtr_t)hid_report_keyboard_nkro;
+        return sizeof(hid_report_keyboard_nkro);
     }
 
-    usbMsgPtr = (usbMsgPtr_t)hid_report_rawhid;
-    return sizeof(hid_report_rawhid);
+    usbMsgPtr = (usbMsgPtr_t)hid_report_keyboard;
+    return sizeof(hid_report_keyboard);
 }
@@ -1,9 +1,9 @@
 /**
  * usb_descriptors.h - Dynamic USB descriptors
  *
- * Provides USB descriptors based on current device mode.
- * Programming mode: Raw HID (Usage Page 0xFF00)
- * Keyboard mode: Boot Protocol HID (Usage Page 0x01)
+ * Provides the composite configuration and per-interface HID descriptors.
+ * Interface 0: Boot Protocol HID (Usage Page 0x01)
+ * Interface 1: Raw HID (Usage Page 0xFF00)
  */
 
 #ifndef USB_DESCRIPTORS_H
@@ -26,6 +26,10 @@
 #define DESCRIPTOR_TYPE_HID           0x21
 #define DESCRIPTOR_TYPE_HID_REPORT    0x22
 
+/* Interface numbers (wIndex of interface requests) */
+#define USB_INTERFACE_KEYBOARD        0
+#define USB_INTERFACE_RAWHID          1
+
 /* -------------------------------------------------------------------------- */
 /* Public API                                                                 */
 /* -------------------------------------------------------------------------- */
@@ -33,7 +37,7 @@
 /* Descriptor Access (called by usb_dispatcher.c via usbFunctionDescriptor) */
 
 usbMsgLen_t descriptors_get_configuration(void);
-usbMsgLen_t descriptors_get_hid(void);
-usbMsgLen_t descriptors_get_hid_report(void);
+usbMsgLen_t descriptors_get_hid(uint8_t interface);
+usbMsgLen_t descriptors_get_hid_report(uint8_t interface);
 
 #endif /* USB_DESCRIPTORS_H */
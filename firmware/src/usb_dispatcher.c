@@ -2,16 +2,23 @@
  * usb_dispatcher.c - V-USB callback dispatcher
  *
  * Implements V-USB callbacks and routes requests to appropriate handlers
- * based on current device mode:
- *   Programming mode -> usb_rawhid
- *   Keyboard mode -> usb_keyboard
+ * based on the target interface (wIndex):
+ *   Interface 0 -> usb_keyboard
+ *   Interface 1 -> usb_rawhid
  */
 
 #include "usb_dispatcher.h"
 #include "usb_descriptors.h"
 #include "usb_keyboard.h"
 #include "usb_rawhid.h"
-#include "device_mode.h"
+
+/* -------------------------------------------------------------------------- */
+/* Private                                                                    */
+/* -------------------------------------------------------------------------- */
+
+/* State */
+
+static uint8_t active_interface;   /* Target of the current control transfer */
 
 /* -------------------------------------------------------------------------- */
 /* V-USB Callbacks                                                            */
@@ -21,44 +28,46 @@ usbMsgLen_t usbFunctionSetup(uint8_t data[8]) {
     usbRequest_t *request = (void *)data;
 
     if ((request->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS) {
-        if (device_mode_is_keyboard()) {
-            return keyboard_handle_setup(request);
-        } else {
+        active_interface = request->wIndex.bytes[0];
+        if (active_interface == USB_INTERFACE_RAWHID) {
             return rawhid_handle_setup(request);
+        } else {
+            return keyboard_handle_setup(request);
         }
     }
 
     return 0;
 }
 
-usbMsgLen_t usbFunctionWrite(uint8_t *data, uchar len) {
-    if (device_mode_is_keyboard()) {
-        return keyboard_handle_write(data, len);
-    } else {
+uchar usbFunctionWrite(uint8_t *data, uchar len) {
+    if (active_interface == USB_INTERFACE_RAWHID) {
         return rawhid_handle_write(data, len);
+    } else {
+        return keyboard_handle_write(data, len);
     }
 }
 
 uchar usbFunctionRead(uchar *data, uchar len) {
-    if (device_mode_is_keyboard()) {
-        return 0;
-    } else {
+    if (active_interface == USB_INTERFACE_RAWHID) {
         return rawhid_handle_read(data, len);
+    } else {
+        return 0;
     }
 }
 
 usbMsgLen_t usbFunctionDescriptor(struct usbRequest *request) {
     uint8_t descriptor_type = request->wValue.bytes[1];
+    uint8_t interface = request->wIndex.bytes[0];
 
     switch (descriptor_type) {
         case DESCRIPTOR_TYPE_CONFIGURATION:
             return descriptors_get_configuration();
 
         case DESCRIPTOR_TYPE_HID:
-            return descriptors_get_hid();
+            return descriptors_get_hid(interface);
 
         case DESCRIPTOR_TYPE_HID_REPORT:
-            return descriptors_get_hid_report();
+            return descriptors_get_hid_report(interface);
 
         default:
             return 0;
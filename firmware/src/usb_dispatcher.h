@@ -2,9 +2,9 @@
  * usb_dispatcher.h - V-USB callback dispatcher
  *
  * Implements V-USB callbacks and routes requests to appropriate handlers
- * based on current device mode:
- *   Programming mode -> usb_rawhid
- *   Keyboard mode -> usb_keyboard
+ * based on the target interface (wIndex):
+ *   Interface 0 -> usb_keyboard
+ *   Interface 1 -> usb_rawhid
  */
 
 #ifndef USB_DISPATCHER_H
@@ -1,12 +1,44 @@
 /**
  * usb_keyboard.c - USB HID keyboard interface
  *
- * Handles Boot Protocol HID keyboard communication.
+ * Handles Boot Protocol HID keyboard communication, optionally with an
+ * N-key rollover bitmap report for hosts in report protocol.
  * Report descriptor is provided dynamically by usb_descriptors module.
  * USB connection init is handled by device_mode module.
+ *
+ * Queue entries use the 8-byte boot layout, or the 16-byte NKRO layout when
+ * NKRO is enabled, so the same queue memory holds 6 or 3 reports. NKRO
+ * reports are converted to the boot layout when staged for a host that
+ * switched to boot protocol with SET_PROTOCOL. A packet still waiting in
+ * the V-USB buffer at that point is taken back, so the current report goes
+ * out again from its first packet in the new layout. The same happens after
+ * a bus reset or suspend, which can cut an NKRO report between its packets.
+ *
+ * Reports are queued and handed to V-USB by keyboard_flush() (called from
+ * usb_poll()) as soon as the interrupt endpoint is free, so callers only
+ * block when the queue is full.
+ *
+ * Each time a staged report is taken by the host, the USB frame number is
+ * recorded. Back-to-back deliveries give the host's actual EP1 polling
+ * period in whole frames, so callers can predict which frames the next
+ * polls fall in.
+ *
+ * Reports carry an 8-bit serial, counted when queued and again when taken
+ * from the queue, so reports on other endpoints can wait for a given
+ * keyboard report to leave without waiting for the whole queue.
+ *
+ * A Caps Lock probe queues a tap (press and release) and watches the LED
+ * output report for the toggled state. The caller keeps the probe state,
+ * so the script engine and the latency probe share the primitive and its
+ * timeout without sharing a run.
  */
 
 #include "usb_keyboard.h"
+#include "usb_core.h"
+#include "keycode.h"
+#include "timer.h"
+
+#include <avr/interrupt.h>
 
 /* -------------------------------------------------------------------------- */
 /* Private                                                                    */
@@ -14,20 +46,145 @@
 
 /* State */
 
-static uint8_t report_buffer[KEYBOARD_REPORT_SIZE];
+/* Last report in the queue layout (boot, or NKRO: modifiers, reserved, bitmap) */
+static uint8_t report_buffer[KEYBOARD_NKRO_REPORT_SIZE];
+static uint8_t boot_buffer[KEYBOARD_REPORT_SIZE];   /* NKRO report in boot protocol */
+static uint8_t queue[KEYBOARD_QUEUE_BYTES];
+static uint8_t entry_size;       /* Bytes per queued report */
+static uint8_t queue_capacity;   /* Reports that fit in the queue */
+static uint8_t queue_head;
+static uint8_t queue_count;
+static uint8_t queued_serial;    /* Serial of the last queued report */
+static uint8_t staged_serial;    /* Serial of the last report taken from the queue */
+static uint8_t next_packet;      /* Offset of the second NKRO packet, 0 if none */
+static bool restage;             /* Last report must go out again in a new layout */
 static uint8_t idle_rate;
 static uint8_t protocol_version;
 static uint8_t led_state;
+static bool led_reported;     /* Host has sent an LED output report */
 static bool has_communicated;
+static bool nkro;
+
+/* EP1 poll tracking */
+
+static struct {
+    uint32_t last_frame;   /* Frame in which a staged packet was last taken */
+    uint8_t period;        /* Polling period in frames */
+    uint8_t candidate;     /* Last measured period, awaiting confirmation */
+    bool staged;           /* A packet is waiting in the V-USB buffer */
+    bool back_to_back;     /* It was staged at the previous delivery */
+    bool valid;            /* last_frame holds a real delivery */
+} poll;
 
 /* Helpers */
 
-static void build_report(uint8_t modifiers, const uint8_t *keys, uint8_t key_count) {
-    report_buffer[0] = modifiers;
-    report_buffer[1] = 0x00;
+static void track_delivery(void) {
+    uint32_t now = usb_frames();
+
+    /*
+     * Only back-to-back deliveries measure exactly one polling period. A
+     * delivery noticed a frame late skews one gap, so a period is taken
+     * only when two gaps in a row agree.
+     */
+    if (poll.back_to_back) {
+        uint32_t delta = now - poll.last_frame;
+        if (delta != 0 && delta <= KEYBOARD_POLL_MAX_FRAMES) {
+            if (delta == poll.candidate) {
+                poll.period = (uint8_t)delta;
+            }
+            poll.candidate = (uint8_t)delta;
+        }
+    }
+
+    poll.last_frame = now;
+    poll.valid = true;
+    poll.staged = false;
+}
+
+static void stage_packet(const uint8_t *packet, bool back_to_back) {
+    usbSetInterrupt((uchar *)packet, KEYBOARD_REPORT_SIZE);
+    poll.staged = true;
+    poll.back_to_back = back_to_back;
+}
+
+static void withdraw_report(void) {
+    /* An unsent packet already took a DATA0/DATA1 toggle: undo it too */
+    cli();
+    if (!usbInterruptIsReady()) {
+        usbTxLen1 = USBPID_NAK;
+        usbTxBuf1[0] ^= USBPID_DATA0 ^ USBPID_DATA1;
+    }
+    sei();
+
+    poll.staged = false;
+    next_packet = 0;
+    restage = true;
+}
+
+static bool sends_nkro(void) {
+    return nkro && protocol_version == KEYBOARD_PROTOCOL_REPORT;
+}
+
+static void build_report(uint8_t *report, uint8_t modifiers, const uint8_t *keys, uint8_t key_count) {
+    report[0] = modifiers;
+    report[1] = 0x00;
+
+    if (!nkro) {
+        for (uint8_t i = 0; i < KEYBOARD_MAX_KEYS; i++) {
+            report[2 + i] = (i < key_count) ? keys[i] : 0x00;
+        }
+        return;
+    }
+
+    for (uint8_t i = 2; i < KEYBOARD_NKRO_REPORT_SIZE; i++) {
+        report[i] = 0x00;
+    }
+
+    for (uint8_t i = 0; i < key_count; i++) {
+        uint8_t key = keys[i];
+        if (key < KEYBOARD_NKRO_KEY_LIMIT) {
+            report[2 + (key >> 3)] |= (uint8_t)(1 << (key & 7));
+        }
+    }
+}
+
+static void build_boot_report(void) {
+    uint8_t count = 0;
+
+    boot_buffer[0] = report_buffer[0];
+    boot_buffer[1] = 0x00;
+
+    for (uint8_t i = 0; i < KEYBOARD_NKRO_REPORT_SIZE - 2; i++) {
+        uint8_t bits = report_buffer[2 + i];
+        for (uint8_t bit = 0; bits != 0; bit++, bits >>= 1) {
+            if (bits & 1) {
+                if (count < KEYBOARD_MAX_KEYS) {
+                    boot_buffer[2 + count] = (uint8_t)(i * 8 + bit);
+                }
+                count++;
+            }
+        }
+    }
 
+    /* Too many keys for the boot array: report phantom state */
     for (uint8_t i = 0; i < KEYBOARD_MAX_KEYS; i++) {
-        report_buffer[2 + i] = (i < key_count) ? keys[i] : 0x00;
+        if (count > KEYBOARD_MAX_KEYS) {
+            boot_buffer[2 + i] = KEYBOARD_ERROR_ROLLOVER;
+        } else if (i >= count) {
+            boot_buffer[2 + i] = 0x00;
+        }
+    }
+}
+
+static void stage_report(bool back_to_back) {
+    if (sends_nkro()) {
+        stage_packet(report_buffer, back_to_back);
+        next_packet = KEYBOARD_REPORT_SIZE;
+    } else if (nkro) {
+        build_boot_report();
+        stage_packet(boot_buffer, back_to_back);
+    } else {
+        stage_packet(report_buffer, back_to_back);
     }
 }
 
@@ -52,12 +209,25 @@ usbMsgLen_t keyboard_handle_setup(usbRequest_t *rq) {
             return 1;
 
         case USBRQ_HID_SET_PROTOCOL:
-            protocol_version = rq->wValue.bytes[1];
+            /* Nothing staged in the old layout may reach the host */
+            if (protocol_version != rq->wValue.bytes[1]) {
+                protocol_version = rq->wValue.bytes[1];
+                withdraw_report();
+            }
             return 0;
 
         case USBRQ_HID_GET_REPORT:
-            usbMsgPtr = (usbMsgPtr_t)report_buffer;
-            return sizeof(report_buffer);
+            if (sends_nkro()) {
+                usbMsgPtr = (usbMsgPtr_t)report_buffer;
+                return KEYBOARD_NKRO_REPORT_SIZE;
+            }
+            if (nkro) {
+                build_boot_report();
+                usbMsgPtr = (usbMsgPtr_t)boot_buffer;
+            } else {
+                usbMsgPtr = (usbMsgPtr_t)report_buffer;
+            }
+            return KEYBOARD_REPORT_SIZE;
 
         case USBRQ_HID_SET_REPORT:
             if (rq->wLength.word == 1) {
@@ -70,9 +240,10 @@ usbMsgLen_t keyboard_handle_setup(usbRequest_t *rq) {
     }
 }
 
-usbMsgLen_t keyboard_handle_write(uint8_t *data, uint8_t len) {
+uint8_t keyboard_handle_write(uint8_t *data, uint8_t len) {
     if (len > 0) {
         led_state = data[0];
+        led_reported = true;
     }
     return 1;
 }
@@ -83,48 +254,160 @@ usbMsgLen_t keyboard_handle_write(uint8_t *data, uint8_t len) {
 
 /* Lifecycle */
 
-void keyboard_init(void) {
-    for (uint8_t i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
+void keyboard_init(bool use_nkro) {
+    for (uint8_t i = 0; i < KEYBOARD_NKRO_REPORT_SIZE; i++) {
         report_buffer[i] = 0;
     }
+    nkro = use_nkro;
+    entry_size = nkro ? KEYBOARD_NKRO_REPORT_SIZE : KEYBOARD_REPORT_SIZE;
+    queue_capacity = KEYBOARD_QUEUE_BYTES / entry_size;
+    queue_head = 0;
+    queue_count = 0;
+    queued_serial = 0;
+    staged_serial = 0;
+    next_packet = 0;
+    restage = false;
     idle_rate = 500 / 4;
-    protocol_version = 0;
+    protocol_version = KEYBOARD_PROTOCOL_REPORT;   /* HID default after reset */
     led_state = 0;
+    led_reported = false;
     has_communicated = false;
+
+    poll.last_frame = 0;
+    poll.period = USB_CFG_INTR_POLL_INTERVAL;
+    poll.candidate = 0;
+    poll.staged = false;
+    poll.back_to_back = false;
+    poll.valid = false;
 }
 
 /* USB Maintenance */
 
+void keyboard_flush(void) {
+    bool delivered = false;
+
+    if (!usbInterruptIsReady()) {
+        return;
+    }
+
+    if (poll.staged) {
+        track_delivery();
+        delivered = true;
+    }
+
+    /* NKRO reports span two 8-byte packets */
+    if (next_packet != 0) {
+        stage_packet(&report_buffer[next_packet], delivered);
+        next_packet = 0;
+        return;
+    }
+
+    if (restage) {
+        restage = false;
+        stage_report(delivered);
+        return;
+    }
+
+    if (queue_count == 0) {
+        return;
+    }
+
+    const uint8_t *entry = &queue[queue_head * entry_size];
+    for (uint8_t i = 0; i < entry_size; i++) {
+        report_buffer[i] = entry[i];
+    }
+    stage_report(delivered);
+    staged_serial++;
+
+    if (++queue_head == queue_capacity) {
+        queue_head = 0;
+    }
+    queue_count--;
+}
+
+void keyboard_resync(void) {
+    if (poll.staged || next_packet != 0) {
+        withdraw_report();
+    }
+}
+
+/* Poll Prediction */
+
+uint32_t keyboard_align_to_poll(uint32_t target_frame) {
+    if (!poll.valid) {
+        return target_frame;
+    }
+
+    /* Nearest predicted poll, never more than half a period away */
+    uint32_t offset = target_frame - poll.last_frame + poll.period / 2;
+
+    /* Over a minute since the last delivery: the phase is long lost */
+    if (offset > 0xFFFF) {
+        return target_frame;
+    }
+
+    uint8_t phase = (uint16_t)offset % poll.period;
+    return target_frame + poll.period / 2 - phase;
+}
+
 bool keyboard_is_ready(void) {
-    return usbInterruptIsReady();
+    return queue_count < queue_capacity;
+}
+
+bool keyboard_is_idle(void) {
+    return queue_count == 0 && next_packet == 0 && !restage && usbInterruptIsReady();
+}
+
+uint8_t keyboard_queue_space(void) {
+    return queue_capacity - queue_count;
+}
+
+/* Report Order */
+
+uint8_t keyboard_last_report(void) {
+    return queued_serial;
+}
+
+bool keyboard_has_delivered(uint8_t serial) {
+    uint8_t behind = staged_serial - serial;
+
+    /* Still in the queue */
+    if (behind >= 0x80) {
+        return false;
+    }
+
+    /* A later report was staged, so every packet of this one was taken */
+    return behind != 0 || (next_packet == 0 && !restage && usbInterruptIsReady());
 }
 
 /* Report Sending */
 
 bool keyboard_send_report(uint8_t modifiers, const uint8_t *keys, uint8_t key_count) {
-    if (!usbInterruptIsReady()) {
+    if (queue_count >= queue_capacity) {
         return false;
     }
 
-    if (key_count > KEYBOARD_MAX_KEYS) {
-        key_count = KEYBOARD_MAX_KEYS;
+    if (key_count > keyboard_max_keys()) {
+        key_count = keyboard_max_keys();
     }
 
-    build_report(modifiers, keys, key_count);
-    usbSetInterrupt((uchar *)report_buffer, sizeof(report_buffer));
+    uint8_t slot = queue_head + queue_count;
+    if (slot >= queue_capacity) {
+        slot -= queue_capacity;
+    }
+    build_report(&queue[slot * entry_size], modifiers, keys, key_count);
+    queue_count++;
+    queued_serial++;
 
+    keyboard_flush();
     return true;
 }
 
 void keyboard_release_all(void) {
-    while (!usbInterruptIsReady()) {
+    while (!keyboard_send_report(0, 0, 0)) {
         usbPoll();
+        keyboard_flush();
     }
-
-    for (uint8_t i = 0; i < KEYBOARD_REPORT_SIZE; i++) {
-        report_buffer[i] = 0;
-    }
-    usbSetInterrupt((uchar *)report_buffer, sizeof(report_buffer));
 }
 
 /* Status */
@@ -136,3 +419,47 @@ bool keyboard_is_connected(void) {
 uint8_t keyboard_get_led_state(void) {
     return led_state;
 }
+
+bool keyboard_has_led_report(void) {
+    return led_reported;
+}
+
+/* Caps Lock Probe */
+
+bool keyboard_probe_tap(keyboard_probe_t *probe) {
+    static const uint8_t caps_lock = KEY_CAPS_LOCK;
+
+    if (keyboard_queue_space() < KEYBOARD_PROBE_REPORTS) {
+        return false;
+    }
+
+    /* Caps Lock alone, whatever the caller holds */
+    probe->leds = led_state;
+    probe->start = timer_millis();
+    keyboard_send_report(0, &caps_lock, 1);
+    keyboard_send_report(0, 0, 0);
+    return true;
+}
+
+keyboard_probe_result_t keyboard_probe_poll(const keyboard_probe_t *probe, uint16_t *rtt_ms) {
+    uint16_t elapsed = timer_millis() - probe->start;
+
+    *rtt_ms = elapsed;
+    if ((led_state ^ probe->leds) & KEYBOARD_LED_CAPS_LOCK) {
+        return KEYBOARD_PROBE_ECHOED;
+    }
+    if (elapsed >= KEYBOARD_PROBE_TIMEOUT_MS) {
+        return KEYBOARD_PROBE_TIMEOUT;
+    }
+    return KEYBOARD_PROBE_WAITING;
+}
+
+/* Rollover */
+
+bool keyboard_is_nkro(void) {
+    return nkro;
+}
+
+uint8_t keyboard_max_keys(void) {
+    return nkro ? KEYBOARD_NKRO_MAX_KEYS : KEYBOARD_MAX_KEYS;
+}
@@ -2,7 +2,8 @@
  * usb_keyboard.h - USB HID keyboard interface
  *
  * Encapsulates V-USB keyboard communication. Provides a clean interface for
- * sending keyboard reports to the host.
+ * sending keyboard reports to the host, in boot or NKRO layout, and the
+ * Caps Lock round trip used to time the host's input handling.
  */
 
 #ifndef USB_KEYBOARD_H
@@ -17,6 +18,42 @@
 
 #define KEYBOARD_REPORT_SIZE 8
 #define KEYBOARD_MAX_KEYS    6
+#define KEYBOARD_QUEUE_BYTES 48  /* Pending reports awaiting EP1: 6 boot or 3 NKRO */
+
+#define KEYBOARD_POLL_MAX_FRAMES 32   /* Longest plausible EP1 polling period */
+
+/* NKRO report: modifiers, reserved, 112-bit key bitmap (two EP1 packets) */
+#define KEYBOARD_NKRO_REPORT_SIZE 16
+#define KEYBOARD_NKRO_KEY_LIMIT   0x70   /* Keycodes 0x00-0x6F are reportable */
+#define KEYBOARD_NKRO_MAX_KEYS    14
+
+#define KEYBOARD_PROTOCOL_BOOT    0
+#define KEYBOARD_PROTOCOL_REPORT  1
+#define KEYBOARD_ERROR_ROLLOVER   0x01
+
+/* LED output report bits */
+#define KEYBOARD_LED_NUM_LOCK    0x01
+#define KEYBOARD_LED_CAPS_LOCK   0x02
+#define KEYBOARD_LED_SCROLL_LOCK 0x04
+
+/* Caps Lock round trip */
+#define KEYBOARD_PROBE_REPORTS    2     /* Reports queued by one Caps Lock tap */
+#define KEYBOARD_PROBE_TIMEOUT_MS 250   /* No LED echo: host cannot be probed */
+
+/* -------------------------------------------------------------------------- */
+/* Types                                                                      */
+/* -------------------------------------------------------------------------- */
+
+typedef enum {
+    KEYBOARD_PROBE_WAITING,   /* Tap queued, no echo yet */
+    KEYBOARD_PROBE_ECHOED,    /* Host toggled its Caps Lock LED */
+    KEYBOARD_PROBE_TIMEOUT    /* No echo within KEYBOARD_PROBE_TIMEOUT_MS */
+} keyboard_probe_result_t;
+
+typedef struct {
+    uint16_t start;   /* timer_millis() when the tap was queued */
+    uint8_t leds;     /* LED state before the tap */
+} keyboard_probe_t;
 
 /* -------------------------------------------------------------------------- */
 /* Public API                                                                 */
@@ -24,13 +61,26 @@
 
 /* Lifecycle */
 
-void keyboard_init(void);
+void keyboard_init(bool use_nkro);
 
 /* USB Maintenance */
 
+void keyboard_flush(void);
+void keyboard_resync(void);
 bool keyboard_is_ready(void);
+bool keyboard_is_idle(void);
+uint8_t keyboard_queue_space(void);
 bool keyboard_is_connected(void);
 
+/* Report Order */
+
+uint8_t keyboard_last_report(void);
+bool keyboard_has_delivered(uint8_t serial);
+
+/* Poll Prediction */
+
+uint32_t keyboard_align_to_poll(uint32_t target_frame);
+
 /* Report Sending */
 
 bool keyboard_send_report(uint8_t modifiers, const uint8_t *keys, uint8_t key_count);
@@ -39,6 +89,17 @@ void keyboard_release_all(void);
 /* LED State */
 
 uint8_t keyboard_get_led_state(void);
+bool keyboard_has_led_report(void);
+
+/* Caps Lock Probe */
+
+bool keyboard_probe_tap(keyboard_probe_t *probe);
+keyboard_probe_result_t keyboard_probe_poll(const keyboard_probe_t *probe, uint16_t *rtt_ms);
+
+/* Rollover */
+
+bool keyboard_is_nkro(void);
+uint8_t keyboard_max_keys(void);
 
 /* -------------------------------------------------------------------------- */
 /* Internal Handlers (called by usb_dispatcher.c)                              */
@@ -47,6 +108,6 @@ uint8_t keyboard_get_led_state(void);
 #include "usbdrv.h"
 
 usbMsgLen_t keyboard_handle_setup(usbRequest_t *request);
-usbMsgLen_t keyboard_handle_write(uint8_t *data, uint8_t length);
+uint8_t keyboard_handle_write(uint8_t *data, uint8_t length);
 
 #endif /* USB_KEYBOARD_H */
@@ -7,8 +7,8 @@
 
 #include "usb_rawhid.h"
 #include "hid_protocol.h"
+#include "eeprom_storage.h"
 #include "config.h"
-#include <string.h>
 
 /* -------------------------------------------------------------------------- */
 /* Private                                                                    */
@@ -16,9 +16,9 @@
 
 /* State */
 
-static uint8_t report_buffer[PROTOCOL_REPORT_SIZE];
-static uint8_t report_offset;
-static uint8_t expected_length;
+static uint8_t report_id;
+static uint16_t transfer_remaining;
+static bool skip_report_id;
 static uint8_t idle_rate;
 static bool response_pending;
 static bool had_activity;
@@ -31,8 +31,9 @@ static bool had_activity;
 
 void rawhid_init(void) {
     protocol_init();
-    report_offset = 0;
-    expected_length = 0;
+    report_id = 0;
+    transfer_remaining = 0;
+    skip_report_id = false;
     idle_rate = 0;
     response_pending = false;
     had_activity = false;
@@ -43,31 +44,41 @@ void rawhid_init(void) {
 usbMsgLen_t rawhid_handle_setup(usbRequest_t *request) {
     switch (request->bRequest) {
         case USBRQ_HID_GET_REPORT:
-            /* Host wants to read the response */
-            if (response_pending) {
-                const uint8_t *resp = protocol_get_response();
-                uint8_t len = protocol_get_response_length();
-
-                /* Copy response to return buffer */
-                memcpy(report_buffer, resp, len);
-                /* Zero-pad the rest */
-                if (len < PROTOCOL_REPORT_SIZE) {
-                    memset(report_buffer + len, 0, PROTOCOL_REPORT_SIZE - len);
+            /* Host wants to read the response or a bulk dump */
+            report_id = request->wValue.bytes[0];
+
+            if (report_id == PROTOCOL_REPORT_ID_BULK) {
+                /* The dump reads storage, which must not wait here */
+                if (!storage_is_idle()) {
+                    return 0;
                 }
+                protocol_bulk_begin();
+                skip_report_id = true;
+                transfer_remaining = PROTOCOL_BULK_REPORT_SIZE + 1;
+                return USB_NO_MSG;  /* Call rawhid_handle_read for data */
+            }
 
-                usbMsgPtr = (usbMsgPtr_t)report_buffer;
+            /* Response report is sent straight from the protocol buffer */
+            if (response_pending) {
+                usbMsgPtr = (usbMsgPtr_t)protocol_get_response_report();
                 response_pending = false;
-                return PROTOCOL_REPORT_SIZE;
+                return PROTOCOL_REPORT_SIZE + 1;
             }
             return 0;
 
         case USBRQ_HID_SET_REPORT:
-            /* Host wants to send a command report */
+            /* Host wants to send a command or bulk report */
             had_activity = true;
-            report_offset = 0;
-            expected_length = request->wLength.word;
-            if (expected_length > PROTOCOL_REPORT_SIZE) {
-                expected_length = PROTOCOL_REPORT_SIZE;
+            report_id = request->wValue.bytes[0];
+            transfer_remaining = request->wLength.word;
+            skip_report_id = true;
+            if (report_id == PROTOCOL_REPORT_ID_BULK) {
+                protocol_bulk_begin();
+                if (!protocol_bulk_ready()) {
+                    usbDisableAllRequests();   /* NAK data until rawhid_tick() */
+                }
+            } else {
+                protocol_begin_report();
             }
             return USB_NO_MSG;  /* Call rawhid_handle_write for data */
 
@@ -84,42 +95,71 @@ usbMsgLen_t rawhid_handle_setup(usbRequest_t *request) {
     }
 }
 
-usbMsgLen_t rawhid_handle_write(uint8_t *data, uint8_t length) {
+uint8_t rawhid_handle_write(uint8_t *data, uint8_t length) {
     had_activity = true;
 
-    /* Accumulate incoming data */
-    for (uint8_t i = 0; i < length && report_offset < expected_length; i++) {
-        report_buffer[report_offset++] = data[i];
+    if (length > transfer_remaining) {
+        length = (uint8_t)transfer_remaining;
     }
+    transfer_remaining -= length;
 
-    /* When complete, process the command */
-    if (report_offset >= expected_length) {
-        protocol_process_report(report_buffer, expected_length);
-        response_pending = (protocol_get_response_length() > 0);
-        report_offset = 0;
-        return 1;  /* Finished receiving */
+    /* First byte of the data stage is the report ID */
+    if (skip_report_id && length > 0) {
+        skip_report_id = false;
+        data++;
+        length--;
     }
 
-    return 0;  /* More data expected */
-}
+    /* Stream each packet to the protocol, nothing is reassembled */
+    if (report_id == PROTOCOL_REPORT_ID_BULK) {
+        protocol_bulk_write(data, length);
+        if (transfer_remaining > 0 && !protocol_bulk_ready()) {
+            usbDisableAllRequests();   /* NAK data until rawhid_tick() */
+        }
+    } else {
+        protocol_feed_report(data, length);
+    }
 
-uint8_t rawhid_handle_read(uint8_t *data, uint8_t length) {
-    /* Copy response data for GET_REPORT */
-    const uint8_t *resp = protocol_get_response();
-    uint8_t resp_len = protocol_get_response_length();
+    if (transfer_remaining > 0) {
+        return 0;  /* More data expected */
+    }
 
-    uint8_t to_copy = (length < resp_len) ? length : resp_len;
-    memcpy(data, resp, to_copy);
+    /* When complete, finish the command */
+    if (report_id != PROTOCOL_REPORT_ID_BULK) {
+        protocol_end_report();
+        response_pending = (protocol_get_response_length() > 0);
+    }
+    return 1;  /* Finished receiving */
+}
 
-    /* Zero-pad if requested length is greater */
-    if (length > to_copy) {
-        memset(data + to_copy, 0, length - to_copy);
+uint8_t rawhid_handle_read(uint8_t *data, uint8_t length) {
+    /* Only the bulk dump is streamed, responses go through usbMsgPtr */
+    if (length > transfer_remaining) {
+        length = (uint8_t)transfer_remaining;
+    }
+    transfer_remaining -= length;
+
+    /* First byte of the data stage is the report ID */
+    uint8_t offset = 0;
+    if (skip_report_id && length > 0) {
+        skip_report_id = false;
+        data[0] = PROTOCOL_REPORT_ID_BULK;
+        offset = 1;
     }
 
-    response_pending = false;
+    protocol_bulk_read(data + offset, length - offset);
     return length;
 }
 
+/* Maintenance */
+
+void rawhid_tick(void) {
+    /* Resume a bulk upload once storage has room for the next packet */
+    if (usbAllRequestsAreDisabled() && protocol_bulk_ready()) {
+        usbEnableAllRequests();
+    }
+}
+
 /* Status */
 
 bool rawhid_has_pending_response(void) {
@@ -23,9 +23,13 @@ void rawhid_init(void);
 /* USB Handlers (called by usb_dispatcher.c) */
 
 usbMsgLen_t rawhid_handle_setup(usbRequest_t *request);
-usbMsgLen_t rawhid_handle_write(uint8_t *data, uint8_t length);
+uint8_t rawhid_handle_write(uint8_t *data, uint8_t length);
 uint8_t rawhid_handle_read(uint8_t *data, uint8_t length);
 
+/* Maintenance */
+
+void rawhid_tick(void);
+
 /* Status */
 
 bool rawhid_has_pending_response(void);
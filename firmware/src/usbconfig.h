@@ -1,9 +1,10 @@
 /**
  * usbconfig.h - V-USB configuration for TinyKB
  *
- * This configuration enables dynamic USB descriptors for dual-mode operation:
- * - Programming mode: Raw HID (WebHID compatible)
- * - Keyboard mode: Boot Protocol HID
+ * This configuration enables dynamic USB descriptors for a composite device:
+ * - Interface 0: Boot Protocol HID keyboard (EP1)
+ * - Interface 1: Raw HID for programming (WebHID compatible) and, with
+ *                FEATURE_CONSUMER, consumer control reports (EP3)
  *
  * Based on V-USB configuration template.
  * Modified for ATtiny85/Digispark USB Keyboard.
@@ -27,7 +28,7 @@
 /* -------------------------------------------------------------------------- */
 
 #define USB_CFG_HAVE_INTRIN_ENDPOINT        1
-#define USB_CFG_HAVE_INTRIN_ENDPOINT3       0
+#define USB_CFG_HAVE_INTRIN_ENDPOINT3       1
 #define USB_CFG_EP3_NUMBER                  3
 #define USB_CFG_IMPLEMENT_HALT              0
 #define USB_CFG_SUPPRESS_INTR_CODE          0
@@ -37,10 +38,10 @@
 #define USB_CFG_IMPLEMENT_FN_WRITE          1
 #define USB_CFG_IMPLEMENT_FN_READ           1
 #define USB_CFG_IMPLEMENT_FN_WRITEOUT       0
-#define USB_CFG_HAVE_FLOWCONTROL            0
+#define USB_CFG_HAVE_FLOWCONTROL            1   /* Bulk upload waits for storage */
 #define USB_CFG_DRIVER_FLASH_PAGE           0
-#define USB_CFG_LONG_TRANSFERS              0
-#define USB_COUNT_SOF                       0
+#define USB_CFG_LONG_TRANSFERS              1
+#define USB_COUNT_SOF                       1
 #define USB_CFG_CHECK_DATA_TOGGLING         0
 #define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   1
 #define USB_USE_FAST_CRC                    0
@@ -74,10 +75,10 @@ extern void calibrate_oscillator(void);
 #define USB_CFG_DEVICE_SUBCLASS     0
 
 /*
- * Interface class/subclass/protocol are handled dynamically via
- * usb_descriptors.c based on device mode:
- *   Programming mode: Class=0x03, SubClass=0x00, Protocol=0x00
- *   Keyboard mode:    Class=0x03, SubClass=0x01, Protocol=0x01
+ * Interface class/subclass/protocol are set per interface in
+ * usb_descriptors.c:
+ *   Interface 0 (keyboard): Class=0x03, SubClass=0x01, Protocol=0x01
+ *   Interface 1 (raw HID):  Class=0x03, SubClass=0x00, Protocol=0x00
  *
  * These defaults are for the device descriptor (not used for HID).
  */
@@ -91,7 +92,7 @@ extern void calibrate_oscillator(void);
 
 /*
  * Enable dynamic descriptor generation via usbFunctionDescriptor().
- * This allows switching descriptors based on device mode at runtime.
+ * This allows selecting HID descriptors by interface (wIndex).
  */
 #define USB_CFG_DESCR_PROPS_DEVICE                  0
 #define USB_CFG_DESCR_PROPS_CONFIGURATION           USB_PROP_IS_DYNAMIC
@@ -111,8 +112,9 @@ extern void calibrate_oscillator(void);
 /* ATtiny85 Pin Change Interrupt                                              */
 /* -------------------------------------------------------------------------- */
 
+/* On D-: the keep-alive SE0 is only visible there, D+ idles low anyway */
 #define USB_INTR_CFG            PCMSK
-#define USB_INTR_CFG_SET        (1 << USB_CFG_DPLUS_BIT)
+#define USB_INTR_CFG_SET        (1 << USB_CFG_DMINUS_BIT)
 #define USB_INTR_CFG_CLR        0
 #define USB_INTR_ENABLE         GIMSK
 #define USB_INTR_ENABLE_BIT     PCIE
@@ -120,4 +122,21 @@ extern void calibrate_oscillator(void);
 #define USB_INTR_PENDING_BIT    PCIF
 #define USB_INTR_VECTOR         PCINT0_vect
 
+/* -------------------------------------------------------------------------- */
+/* Frame Counting                                                             */
+/* -------------------------------------------------------------------------- */
+
+/*
+ * usbSofCount counts low-speed keep-alives (the SE0 sent once per frame).
+ * The pin change interrupt fires on both edges of the keep-alive, so the
+ * hook clears the edge already pending to count each frame only once.
+ */
+#ifdef __ASSEMBLER__
+macro sofClearPending
+    ldi     YL, 1 << USB_INTR_PENDING_BIT
+    out     USB_INTR_PENDING, YL
+    endm
+#endif
+#define USB_SOF_HOOK            sofClearPending
+
 #endif /* USBCONFIG_H */